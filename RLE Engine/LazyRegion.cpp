@@ -0,0 +1,111 @@
+#include "LazyRegion.h"
+#define NOMINMAX
+#include <Windows.h>
+#include <algorithm>
+#include <shared_mutex>
+#include <stdexcept>
+
+// Defined in MappedFile.cpp
+void throwWindowsError();
+
+// Vectored exception handlers are process wide, so live regions are kept in a registry which
+//   the single handler searches.
+static std::shared_mutex registryMutex;
+static std::vector<LazyRegion*> registry;
+static void* handlerHandle = nullptr;
+
+static LONG CALLBACK lazyRegionHandler(PEXCEPTION_POINTERS info) {
+  // Only reads are resolved. The region is never writable, so a write would fault again on
+  //   every retry. The first parameter is 0 for a read, 1 for a write and 8 for execution.
+  auto record = info->ExceptionRecord;
+  if(record->ExceptionCode != EXCEPTION_ACCESS_VIOLATION || record->NumberParameters < 2 || record->ExceptionInformation[0] != 0) {
+    return EXCEPTION_CONTINUE_SEARCH;
+  }
+
+  auto address = reinterpret_cast<const void*>(record->ExceptionInformation[1]);
+  std::shared_lock lock(registryMutex);
+  for(auto region : registry) {
+    if(region->resolveFault(address)) {
+      return EXCEPTION_CONTINUE_EXECUTION;
+    }
+  }
+  return EXCEPTION_CONTINUE_SEARCH;
+}
+
+LazyRegion::LazyRegion(uint64_t length, uint64_t blockSize, Fill fill) :
+  section(nullptr),
+  readView(nullptr),
+  writeView(nullptr),
+  length(length),
+  blockSize(blockSize),
+  fill(std::move(fill)),
+  ready((size_t)((length + blockSize - 1) / blockSize))
+{
+  if(length == 0) {
+    throw std::runtime_error("LazyRegion cannot be created with a length of zero.");
+  }
+
+  // A pagefile backed section only takes physical memory for the pages which are written.
+  LARGE_INTEGER size;
+  size.QuadPart = length;
+  section = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
+  if(section == nullptr) { throwWindowsError(); }
+
+  readView = static_cast<std::byte*>(MapViewOfFile(section, FILE_MAP_READ, 0, 0, (SIZE_T)length));
+  writeView = static_cast<std::byte*>(MapViewOfFile(section, FILE_MAP_WRITE, 0, 0, (SIZE_T)length));
+  DWORD previous = 0;
+  if(!readView || !writeView || !VirtualProtect(readView, (SIZE_T)length, PAGE_NOACCESS, &previous)) {
+    if(readView) { UnmapViewOfFile(readView); }
+    if(writeView) { UnmapViewOfFile(writeView); }
+    CloseHandle(section);
+    throwWindowsError();
+  }
+
+  std::unique_lock lock(registryMutex);
+  if(!handlerHandle) {
+    handlerHandle = AddVectoredExceptionHandler(1, lazyRegionHandler);
+  }
+  registry.push_back(this);
+}
+
+LazyRegion::~LazyRegion() {
+  {
+    std::unique_lock lock(registryMutex);
+    registry.erase(std::find(registry.begin(), registry.end(), this));
+  }
+  UnmapViewOfFile(readView);
+  UnmapViewOfFile(writeView);
+  CloseHandle(section);
+}
+
+bool LazyRegion::resolveFault(const void* address) {
+  auto target = static_cast<const std::byte*>(address);
+  if(target < readView || target >= readView + length) {
+    return false;
+  }
+
+  size_t block = (size_t)((uint64_t)(target - readView) / blockSize);
+  std::lock_guard lock(mutex);
+  if(ready[block]) {
+    // Another thread filled it while this one waited, and the read will now succeed. Should the
+    //   page have been made unreadable since, the fault is not one this region can resolve.
+    MEMORY_BASIC_INFORMATION page;
+    return VirtualQuery(target, &page, sizeof(page)) != 0 && page.Protect == PAGE_READONLY;
+  }
+
+  uint64_t offset = block * blockSize;
+  size_t span = (size_t)std::min(blockSize, length - offset);
+  try {
+    fill(offset, std::span<std::byte>(writeView + offset, span));
+  }
+  catch(...) {
+    return false;
+  }
+
+  DWORD previous = 0;
+  if(!VirtualProtect(readView + offset, span, PAGE_READONLY, &previous)) {
+    return false;
+  }
+  ready[block] = true;
+  return true;
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <span>
+#include <vector>
+
+/// class LazyRegion
+/// Reserves a read-only region of memory whose content is produced on demand using the
+///   Win32 API. The region starts inaccessible, and the first touch of each block faults.
+///   The fault is resolved by calling fill for that block, after which the block is made
+///   readable and the access is retried. Blocks which are never touched cost no memory.
+/// Other threads touching a block while it is being filled wait for it to be ready.
+/// fill is called from within an exception handler, so it must not throw. If it does, the
+///   fault is passed on as an ordinary access violation, as are writes to the region.
+class LazyRegion {
+public:
+  using Fill = std::function<void(uint64_t offset, std::span<std::byte> block)>;
+
+  // LazyRegion constructor
+  // blockSize must be a multiple of the system page size. The pages handed to fill are
+  //   zeroed, so fill need not write zeros.
+  LazyRegion(uint64_t length, uint64_t blockSize, Fill fill);
+  LazyRegion(const LazyRegion&) = delete;
+  ~LazyRegion();
+
+  std::span<const std::byte> data() const { return std::span<const std::byte>(readView, (size_t)length); }
+  uint64_t size() const { return length; }
+
+  // Fills and publishes the block holding address, if it lies in this region, in answer to a
+  //   read of address which faulted.
+  // Returns false if the address is not in this region, the block could not be filled, or it
+  //   was already filled and is not readable, so that retrying the read would fault again.
+  bool resolveFault(const void* address);
+
+private:
+  void* section;
+  std::byte* readView;  // the region as seen by readers
+  std::byte* writeView; // a second view of the same pages through which blocks are filled
+  uint64_t length;
+  uint64_t blockSize;
+  Fill fill;
+  std::mutex mutex;
+  std::vector<bool> ready;
+
+};
@@ -1,6 +1,7 @@
 #include "MappedFile.h"
 #define NOMINMAX
 #include <Windows.h>
+#include <Psapi.h>
 #include <stdexcept>
 
 // Simple utility function which throws a std::runtime_error with the error message generated from WinAPI.
@@ -43,21 +44,32 @@ private:
 };
 
 MappedFile::MappedFile(const std::string& filename, CreationDisposition disposition, uint64_t desiredLength) {
-  // Translate from enum to CreateFile argument and ensure that newly created files have non-zero length.
-  DWORD disp = OPEN_EXISTING;
-  if(disposition == CreationDisposition::CREATE) {
-    disp = CREATE_NEW;
-    if(desiredLength == 0) {
-      throw std::runtime_error("Forgot to provide desired length when creating a file for mapping.");
-    }
+  if(disposition != CreationDisposition::OPEN && disposition != CreationDisposition::CREATE) {
+    openAnonymous(filename, disposition, desiredLength);
+    return;
   }
 
+  // Translate from enum to CreateFile argument.
+  DWORD disp = disposition == CreationDisposition::CREATE ? CREATE_NEW : OPEN_EXISTING;
+
   // Generate file
   RAIIHandle hFile = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, disp, 0, NULL);
   if(hFile == INVALID_HANDLE_VALUE) { throwWindowsError(); }
 
-  // Map file
+  // A zero-length file cannot be mapped, so an empty file which is not being grown, whether
+  //   newly created or opened as it is, is only held open.
   LARGE_INTEGER size;
+  if(desiredLength == 0) {
+    if(disposition == CreationDisposition::OPEN && !GetFileSizeEx(hFile, &size)) { throwWindowsError(); }
+    if(disposition == CreationDisposition::CREATE || size.QuadPart == 0) {
+      file = hFile.commit();
+      map = nullptr;
+      length = 0;
+      return;
+    }
+  }
+
+  // Map file
   size.QuadPart = desiredLength;
   RAIIHandle hMap = CreateFileMappingA(hFile, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, NULL);
   if(hMap == nullptr) { throwWindowsError(); }
@@ -72,38 +84,120 @@ MappedFile::MappedFile(const std::string& filename, CreationDisposition disposit
   length = size.QuadPart;
 }
 
+void MappedFile::openAnonymous(const std::string& name, CreationDisposition disposition, uint64_t desiredLength) {
+  if(desiredLength == 0 && disposition != CreationDisposition::ATTACH) {
+    throw std::runtime_error("Forgot to provide desired length for an anonymous mapping.");
+  }
+
+  RAIIHandle hMap = nullptr;
+  if(disposition == CreationDisposition::ATTACH) {
+    hMap = OpenFileMappingA(FILE_MAP_WRITE, FALSE, name.c_str());
+    if(hMap == nullptr) { throwWindowsError(); }
+
+    // The creator chose the size and may or may not have been granted large pages, neither of
+    //   which the handle tells. Both are read back from a view of the whole mapping: it is only
+    //   a large page section if it can be viewed with large pages and the view is backed by one.
+    void* probe = nullptr;
+    if(GetLargePageMinimum() != 0) {
+      probe = MapViewOfFile(hMap, FILE_MAP_WRITE | FILE_MAP_LARGE_PAGES, 0, 0, 0);
+    }
+    if(probe) {
+      (void)*static_cast<volatile const char*>(probe); // the page must be resident to be queried
+      PSAPI_WORKING_SET_EX_INFORMATION page{};
+      page.VirtualAddress = probe;
+      largePages = QueryWorkingSetEx(GetCurrentProcess(), &page, sizeof(page)) && page.VirtualAttributes.Valid && page.VirtualAttributes.LargePage;
+    }
+    else {
+      probe = MapViewOfFile(hMap, FILE_MAP_WRITE, 0, 0, 0);
+      if(probe == nullptr) { throwWindowsError(); }
+    }
+
+    MEMORY_BASIC_INFORMATION region;
+    SIZE_T queried = VirtualQuery(probe, &region, sizeof(region));
+    UnmapViewOfFile(probe);
+    if(queried == 0) { throwWindowsError(); }
+    if(desiredLength > region.RegionSize) {
+      throw std::runtime_error("Attached mapping is shorter than the length asked for.");
+    }
+    if(desiredLength == 0 || largePages) {
+      desiredLength = region.RegionSize;
+    }
+  }
+  else {
+    LPCSTR mapName = name.empty() ? NULL : name.c_str();
+    LARGE_INTEGER size;
+
+    // Large pages are refused unless the process holds the lock pages in memory privilege, in
+    //   which case ordinary pages are used instead.
+    SIZE_T largePage = GetLargePageMinimum();
+    if(disposition == CreationDisposition::ANONYMOUS_LARGE_PAGES && largePage != 0) {
+      size.QuadPart = (desiredLength + largePage - 1) / largePage * largePage;
+      hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE | SEC_COMMIT | SEC_LARGE_PAGES, size.HighPart, size.LowPart, mapName);
+      if(hMap != nullptr) {
+        largePages = true;
+        desiredLength = size.QuadPart;
+      }
+    }
+    if(!largePages) {
+      size.QuadPart = desiredLength;
+      hMap = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, size.HighPart, size.LowPart, mapName);
+    }
+    if(hMap == nullptr) { throwWindowsError(); }
+
+    // A named mapping which already exists is opened rather than created, which is never what
+    //   the caller meant when asking for a new one.
+    if(mapName && GetLastError() == ERROR_ALREADY_EXISTS) { throwWindowsError(); }
+  }
+
+  file = nullptr;
+  map = hMap.commit();
+  length = desiredLength;
+}
+
 MappedFile::MappedFile(MappedFile&& other) :
   file(other.file),
   map(other.map),
-  length(other.length)
+  length(other.length),
+  largePages(other.largePages)
 {
   other.file = other.map = nullptr;
 }
 
 MappedFile::~MappedFile() {
-  if(map) {
-    CloseHandle(map);
-    CloseHandle(file);
-  }
+  if(map) { CloseHandle(map); }
+  if(file) { CloseHandle(file); }
 }
 
 MappedFile::View MappedFile::getView(uint64_t offset, size_t viewLength) {
   // For some reason intellisense really hates this function, and commonly reports
   //   errors which do not actually exist.
 
+  // A zero-length view maps nothing, which also serves an empty file that has no mapping.
   if(viewLength == 0) {
-    throw std::runtime_error("MappedFile cannot generate a View object with a length of zero.");
+    if(offset > length) { throw std::runtime_error("MappedFile view offset is past the end of the map."); }
+    return View(nullptr, 0);
   }
 
   SYSTEM_INFO sysInfo;
   GetSystemInfo(&sysInfo);
-  auto& granularity = sysInfo.dwAllocationGranularity;
+  size_t granularity = sysInfo.dwAllocationGranularity;
+  DWORD access = FILE_MAP_WRITE;
+  if(largePages) {
+    granularity = GetLargePageMinimum();
+    access |= FILE_MAP_LARGE_PAGES;
+  }
   size_t grains  = offset / granularity;
   size_t remains = offset % granularity;
 
+  // Large page views must also end on a large page, which the rounded mapping length allows.
+  SIZE_T mapLength = viewLength + remains;
+  if(largePages) {
+    mapLength = (mapLength + granularity - 1) / granularity * granularity;
+  }
+
   LARGE_INTEGER liOffset;
   liOffset.QuadPart = grains * granularity;
-  void* ptr = MapViewOfFile(map, FILE_MAP_WRITE, liOffset.HighPart, liOffset.LowPart, viewLength + remains);
+  void* ptr = MapViewOfFile(map, access, liOffset.HighPart, liOffset.LowPart, mapLength);
   if(ptr == nullptr) { throwWindowsError(); }
   return View(reinterpret_cast<std::byte*>(ptr) + remains, viewLength);
 }
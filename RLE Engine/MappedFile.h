@@ -11,12 +11,25 @@ class MappedFile {
 public:
   enum class CreationDisposition {
     OPEN, // Will open an existing file or throw a std::runtime_error if the file is not found.
-    CREATE // Will create a new file or throw a std::runtime_error if the file already exists.
+    CREATE, // Will create a new file or throw a std::runtime_error if the file already exists.
+    ANONYMOUS, // Will create a mapping backed by memory and the pagefile rather than by a file.
+    ANONYMOUS_LARGE_PAGES, // As ANONYMOUS, using large pages when the process holds the privilege for them.
+    ATTACH // Will open a named ANONYMOUS mapping created by another process, or throw if there is none.
   };
 
   // MappedFile constructor
-  // When disposition is OPEN, length is ignored.
-  // When disposition is CREATE, length must be non-zero.
+  // When disposition is OPEN, length may be zero to map the file as it is, or larger than
+  //   the file to grow it to that length. An empty file opened as it is is left unmapped.
+  // When disposition is CREATE, length may be zero to create an empty file, which is left
+  //   unmapped.
+  // An unmapped file only has zero-length views.
+  // When disposition is ANONYMOUS, ANONYMOUS_LARGE_PAGES or ATTACH, filename is the name of the
+  //   mapping rather than of a file. An anonymous mapping may be left unnamed with an empty
+  //   filename, and it is released with the last MappedFile attached to it. Large page mappings
+  //   are rounded up to a whole number of large pages.
+  // When disposition is ANONYMOUS or ANONYMOUS_LARGE_PAGES, length must be non-zero.
+  // When disposition is ATTACH, the size and page kind are read back from the mapping. length
+  //   may be zero to take the whole mapping, and throws if it is larger than the mapping.
   // Map length can not be adjusted after creation.
   MappedFile(const std::string& filename, CreationDisposition disposition, uint64_t desiredLength = 0);
   MappedFile(const MappedFile&) = delete;
@@ -29,7 +42,7 @@ public:
   class View; // forward declaration
 
   // Returns a View object with the indicated offset and length.
-  // Length may not be zero. Use MappedFile::size() to get map length.
+  // A zero-length view is empty and maps nothing. Use MappedFile::size() to get map length.
   View getView(uint64_t offset, size_t length);
 
   // class MappedFile::View
@@ -52,8 +65,11 @@ public:
   };
 
 private:
+  void openAnonymous(const std::string& name, CreationDisposition disposition, uint64_t desiredLength);
+
   void* file;
   void* map;
   uint64_t length;
+  bool largePages = false; // views must then be aligned to the large page size
 
 };
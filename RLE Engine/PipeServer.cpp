@@ -0,0 +1,48 @@
+#include "PipeServer.h"
+#define NOMINMAX
+#include <Windows.h>
+#include <stdexcept>
+#include <thread>
+
+// Defined in MappedFile.cpp
+void throwWindowsError();
+
+// Reads request lines from a connected pipe until the client disconnects. The thread owns
+//   its copy of handler, as it may outlive serveNamedPipe().
+static void serveConnection(HANDLE pipe, std::function<std::string(const std::string&)> handler) {
+  std::string pending;
+  char buffer[4096];
+  DWORD bytesRead = 0;
+  bool connected = true;
+  while(connected && ReadFile(pipe, buffer, sizeof(buffer), &bytesRead, NULL) && bytesRead != 0) {
+    pending.append(buffer, bytesRead);
+    for(size_t end = pending.find('\n'); connected && end != std::string::npos; end = pending.find('\n')) {
+      std::string request = pending.substr(0, end);
+      pending.erase(0, end + 1);
+      if(!request.empty() && request.back() == '\r') { request.pop_back(); }
+
+      std::string response = handler(request) + "\n";
+      DWORD bytesWritten = 0;
+      connected = WriteFile(pipe, response.data(), (DWORD)response.size(), &bytesWritten, NULL) != FALSE;
+    }
+  }
+
+  FlushFileBuffers(pipe);
+  DisconnectNamedPipe(pipe);
+  CloseHandle(pipe);
+}
+
+void serveNamedPipe(const std::string& pipeName, const std::function<std::string(const std::string&)>& handler) {
+  std::string path = "\\\\.\\pipe\\" + pipeName;
+  while(true) {
+    HANDLE pipe = CreateNamedPipeA(path.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, PIPE_UNLIMITED_INSTANCES, 4096, 4096, 0, NULL);
+    if(pipe == INVALID_HANDLE_VALUE) { throwWindowsError(); }
+
+    // A client may connect between creation and ConnectNamedPipe, which is still a success.
+    if(!ConnectNamedPipe(pipe, NULL) && GetLastError() != ERROR_PIPE_CONNECTED) {
+      CloseHandle(pipe);
+      continue;
+    }
+    std::thread(serveConnection, pipe, handler).detach();
+  }
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <functional>
+#include <string>
+
+/// Serves a line based protocol over a Win32 named pipe, so other local processes can make
+///   requests of this one. Clients on other machines are refused. Each client connection is
+///   served on its own thread, and every line it sends is passed to handler, whose return
+///   value is written back as one line.
+/// Requests on one connection are handled strictly one after another, so responses come back
+///   in request order and a request is not read until the one before it has been answered.
+///   A client wanting several requests run at once opens a connection for each.
+/// Each connection's thread runs on its own copy of handler and is never joined, so it may
+///   outlive this function. Anything handler uses must be owned by it, e.g. through a
+///   std::shared_ptr captured by value, rather than borrowed from the caller.
+/// The pipe is created as \\.\pipe\[pipeName]. This function does not return unless
+///   creating the pipe fails, in which case it throws a std::runtime_error.
+void serveNamedPipe(const std::string& pipeName, const std::function<std::string(const std::string&)>& handler);
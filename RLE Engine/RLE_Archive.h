@@ -0,0 +1,242 @@
+#pragma once
+#include "RLE_Inflate.h"
+#include "RLE_Deflate.h"
+#include <string_view>
+#include <unordered_set>
+
+// An archive holds many deflated members followed by a central directory:
+//   [member frames...][slots][entries][name pool][ArchiveTrailer]
+// Each member is an ordinary sequence of RLE frames, so it keeps its own node formats and
+//   tables. The slots are an open-addressed hash table over member names, and the whole
+//   directory is used in place from the mapping, so finding a member is O(1) and touches
+//   nothing else in the archive.
+
+#pragma pack(push, 1)
+struct ArchiveEntry {
+  uint64_t nameHash;
+  uint64_t nameOffset; // within the name pool
+  uint64_t nameLength;
+  uint64_t dataOffset; // from the start of the archive
+  uint64_t dataLength;
+  uint64_t decompressedLength;
+};
+
+struct ArchiveTrailer {
+  char magic[4] = "RLA";
+  uint64_t directoryOffset = 0;
+  uint64_t entryCount = 0;
+  uint64_t slotCount = 0; // a power of two. Each slot holds an entry index plus one, or zero.
+  uint64_t nameLength = 0;
+
+  void checkMagic() const {
+    static const std::string EXPECT = "RLA";
+    if(!std::equal(EXPECT.begin(), EXPECT.end(), std::span(magic).begin())) {
+      throw std::runtime_error("Attempted to read a non RLE archive.");
+    }
+  }
+};
+#pragma pack(pop)
+
+// FNV-1a
+uint64_t hashName(std::string_view name) {
+  uint64_t hash = 0xCBF29CE484222325;
+  for(char c : name) {
+    hash = (hash ^ (uint8_t)c) * 0x100000001B3;
+  }
+  return hash;
+}
+
+// Deflates every file in memberFilenames into a new archive, naming each member by its path
+//   as given. Members are deflated together with planDeflateBatch(), a batch at a time, so
+//   the number of files open at once stays bounded. Unlike deflateFile(), a member which
+//   does not compress is stored rather than rejected. A name listed more than once is
+//   rejected before anything is written.
+void createArchive(const std::string& archiveFilename, const std::vector<std::string>& memberFilenames, const DeflateOptions& options = {}) {
+  constexpr size_t BATCH_SIZE = 1024;
+
+  std::unordered_set<std::string_view> seen;
+  for(auto& name : memberFilenames) {
+    if(!seen.insert(name).second) {
+      throw std::runtime_error("Archive member listed more than once: " + name);
+    }
+  }
+
+  std::vector<ArchiveEntry> entries(memberFilenames.size());
+  std::string names;
+  uint64_t archiveLength = 0;
+
+  // Grows the archive by length bytes, creating it on the first call, and hands the view of
+  //   them to write, so each batch is deflated straight into the mapping.
+  OutputCleanup cleanup(archiveFilename);
+  auto extend = [&](uint64_t length, auto write) {
+    if(length == 0) { return; }
+    auto disposition = archiveLength == 0 ? MappedFile::CreationDisposition::CREATE : MappedFile::CreationDisposition::OPEN;
+    MappedFile outMap(archiveFilename, disposition, archiveLength + length);
+    cleanup.created();
+    auto outView = outMap.getView(archiveLength, (size_t)length);
+    write(outView);
+    archiveLength += length;
+  };
+
+  for(size_t first = 0; first < memberFilenames.size(); first += BATCH_SIZE) {
+    size_t count = std::min(BATCH_SIZE, memberFilenames.size() - first);
+
+    MappedInputs inputs(std::span<const std::string>(memberFilenames).subspan(first, count));
+    auto plans = planDeflateBatch(inputs.spans, options);
+
+    uint64_t batchLength = 0;
+    for(size_t i = 0; i < count; i++) {
+      auto& entry = entries[first + i];
+      auto& name = memberFilenames[first + i];
+      entry.nameHash = hashName(name);
+      entry.nameOffset = names.size();
+      entry.nameLength = name.size();
+      entry.dataOffset = archiveLength + batchLength;
+      entry.dataLength = plans[i].size();
+      entry.decompressedLength = inputs.spans[i].size();
+      names += name;
+      batchLength += plans[i].size();
+    }
+
+    extend(batchLength, [&](std::span<std::byte> batch) {
+      std::vector<std::span<std::byte>> outs(count);
+      for(size_t i = 0; i < count; i++) {
+        outs[i] = batch.subspan((size_t)(entries[first + i].dataOffset - archiveLength), (size_t)plans[i].size());
+      }
+      writeBatch(plans, outs);
+    });
+  }
+
+  uint64_t slotCount = 1;
+  while(slotCount < entries.size() * 2) { slotCount <<= 1; }
+  std::vector<uint64_t> slots((size_t)slotCount);
+  for(size_t i = 0; i < entries.size(); i++) {
+    uint64_t slot = entries[i].nameHash & (slotCount - 1);
+    while(slots[(size_t)slot] != 0) {
+      slot = (slot + 1) & (slotCount - 1);
+    }
+    slots[(size_t)slot] = i + 1;
+  }
+
+  // The directory is aligned so its slots and entries can be read in place.
+  std::vector<std::byte> directory((size_t)((alignof(uint64_t) - archiveLength % alignof(uint64_t)) % alignof(uint64_t)));
+
+  ArchiveTrailer trailer;
+  trailer.directoryOffset = archiveLength + directory.size();
+  trailer.entryCount = entries.size();
+  trailer.slotCount = slotCount;
+  trailer.nameLength = names.size();
+
+  auto appendBytes = [&](auto span) {
+    auto bytes = std::as_bytes(span);
+    directory.insert(directory.end(), bytes.begin(), bytes.end());
+  };
+  appendBytes(std::span(slots));
+  appendBytes(std::span(entries));
+  appendBytes(std::span(names));
+  appendBytes(std::span(&trailer, 1));
+  extend(directory.size(), [&](std::span<std::byte> out) {
+    std::copy(directory.begin(), directory.end(), out.begin());
+  });
+  cleanup.commit();
+}
+
+// class ArchiveReader
+// Maps an archive and looks members up through its central directory, which is used in
+//   place. Members are inflated individually without touching any other member.
+class ArchiveReader {
+public:
+  explicit ArchiveReader(const std::string& archiveFilename) :
+    map(archiveFilename, MappedFile::CreationDisposition::OPEN),
+    view(map.getView(0, map.size()))
+  {
+    if(view.size() < sizeof(ArchiveTrailer)) {
+      throw std::runtime_error("Archive is too short to contain a directory.");
+    }
+    auto trailer = reinterpret_cast<const ArchiveTrailer*>(view.data() + view.size() - sizeof(ArchiveTrailer));
+    trailer->checkMagic();
+
+    // Each count is checked against the space left for it, so a damaged trailer can neither
+    //   overflow the length arithmetic nor leave find() probing without an end.
+    uint64_t available = view.size() - sizeof(ArchiveTrailer);
+    if(trailer->directoryOffset > available || trailer->directoryOffset % alignof(uint64_t) != 0) {
+      throw std::runtime_error("Archive directory is malformed.");
+    }
+    available -= trailer->directoryOffset;
+    if(trailer->slotCount == 0 || (trailer->slotCount & (trailer->slotCount - 1)) != 0 || trailer->slotCount > available / sizeof(uint64_t)) {
+      throw std::runtime_error("Archive directory is malformed.");
+    }
+    available -= trailer->slotCount * sizeof(uint64_t);
+    if(trailer->entryCount >= trailer->slotCount || trailer->entryCount > available / sizeof(ArchiveEntry)) {
+      throw std::runtime_error("Archive directory is malformed.");
+    }
+    available -= trailer->entryCount * sizeof(ArchiveEntry);
+    if(trailer->nameLength != available) {
+      throw std::runtime_error("Archive directory is malformed.");
+    }
+
+    auto directory = view.data() + trailer->directoryOffset;
+    slots = std::span(reinterpret_cast<const uint64_t*>(directory), (size_t)trailer->slotCount);
+    directory += slots.size_bytes();
+    entries = std::span(reinterpret_cast<const ArchiveEntry*>(directory), (size_t)trailer->entryCount);
+    directory += entries.size_bytes();
+    names = std::string_view(reinterpret_cast<const char*>(directory), (size_t)trailer->nameLength);
+  }
+
+  std::span<const ArchiveEntry> members() const { return entries; }
+
+  std::string_view name(const ArchiveEntry& entry) const {
+    return names.substr((size_t)entry.nameOffset, (size_t)entry.nameLength);
+  }
+
+  // Returns the entry for the named member, or null if the archive has no such member.
+  //   Probing stops after every slot has been visited, should a damaged table have none free.
+  const ArchiveEntry* find(std::string_view memberName) const {
+    uint64_t hash = hashName(memberName);
+    uint64_t slot = hash & (slots.size() - 1);
+    for(size_t step = 0; step < slots.size() && slots[(size_t)slot] != 0; step++, slot = (slot + 1) & (slots.size() - 1)) {
+      if(slots[(size_t)slot] > entries.size()) {
+        throw std::runtime_error("Archive directory is malformed.");
+      }
+      auto& entry = entries[(size_t)slots[(size_t)slot] - 1];
+      if(entry.nameHash == hash && name(entry) == memberName) {
+        return &entry;
+      }
+    }
+    return nullptr;
+  }
+
+  // Returns the deflated frames of a member.
+  std::span<const std::byte> data(const ArchiveEntry& entry) const {
+    if(entry.dataOffset > view.size() || entry.dataLength > view.size() - entry.dataOffset) {
+      throw std::runtime_error("Archive member lies outside the archive.");
+    }
+    return std::span<const std::byte>(view).subspan((size_t)entry.dataOffset, (size_t)entry.dataLength);
+  }
+
+  // Inflates a member into out, which must be exactly entry.decompressedLength bytes long.
+  void inflate(const ArchiveEntry& entry, std::span<std::byte> out) const {
+    auto frames = readFrames(data(entry));
+    inflateFrames(frames, out, frames.size() > 1);
+  }
+
+  void extract(std::string_view memberName, const std::string& outputFilename) const {
+    auto entry = find(memberName);
+    if(!entry) {
+      throw std::runtime_error("Archive has no member named " + std::string(memberName));
+    }
+
+    MappedFile outMap(outputFilename, MappedFile::CreationDisposition::CREATE, entry->decompressedLength);
+    if(entry->decompressedLength == 0) { return; }
+    auto outView = outMap.getView(0, outMap.size());
+    inflate(*entry, outView);
+  }
+
+private:
+  MappedFile map;
+  MappedFile::View view;
+  std::span<const uint64_t> slots;
+  std::span<const ArchiveEntry> entries;
+  std::string_view names;
+
+};
@@ -0,0 +1,226 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Storage for the run and node tables built during deflate. Tables are kept in fixed size
+//   chunks rather than one growing buffer, so appending never relocates what is already
+//   stored, and finished tables are written out chunk by chunk without being gathered.
+
+// class ChunkPool
+// A per-thread free list of chunks. Chunks go back to the pool of whichever thread releases
+//   them, and since the worker threads live as long as the process, deflate calls after the
+//   first mostly reuse memory instead of allocating it.
+class ChunkPool {
+public:
+  static constexpr size_t CHUNK_BYTES = 1 << 18;
+  static constexpr size_t MAX_RETAINED = 8; // chunks kept per thread beyond which they are freed
+
+  static ChunkPool& local() {
+    thread_local ChunkPool pool;
+    return pool;
+  }
+
+  ChunkPool() = default;
+  ChunkPool(const ChunkPool&) = delete;
+  ChunkPool& operator=(const ChunkPool&) = delete;
+
+  ~ChunkPool() {
+    for(auto chunk : retained) {
+      ::operator delete(chunk);
+    }
+  }
+
+  std::byte* acquire() {
+    if(retained.empty()) {
+      return static_cast<std::byte*>(::operator new(CHUNK_BYTES));
+    }
+    auto chunk = retained.back();
+    retained.pop_back();
+    return chunk;
+  }
+
+  void release(std::byte* chunk) {
+    if(retained.size() < MAX_RETAINED) {
+      retained.push_back(chunk);
+    }
+    else {
+      ::operator delete(chunk);
+    }
+  }
+
+private:
+  std::vector<std::byte*> retained;
+
+};
+
+// class ArenaStorage
+// An untyped sequence of chunks, each filled to some number of bytes. A finished table is
+//   held in this form, and several tables may be spliced into one without copying.
+class ArenaStorage {
+public:
+  ArenaStorage() = default;
+  ArenaStorage(const ArenaStorage&) = delete;
+  ArenaStorage& operator=(const ArenaStorage&) = delete;
+
+  ArenaStorage(ArenaStorage&& other) noexcept :
+    chunkList(std::move(other.chunkList)),
+    byteCount(std::exchange(other.byteCount, 0))
+  {
+    other.chunkList.clear();
+  }
+
+  ArenaStorage& operator=(ArenaStorage&& other) noexcept {
+    if(this != &other) {
+      releaseAll();
+      chunkList = std::move(other.chunkList);
+      other.chunkList.clear();
+      byteCount = std::exchange(other.byteCount, 0);
+    }
+    return *this;
+  }
+
+  ~ArenaStorage() { releaseAll(); }
+
+  size_t sizeBytes() const { return byteCount; }
+  size_t chunkCount() const { return chunkList.size(); }
+
+  std::span<const std::byte> chunk(size_t i) const {
+    return std::span<const std::byte>(chunkList[i].data, chunkList[i].used);
+  }
+
+  // Moves the chunks of other onto the end of this storage.
+  void splice(ArenaStorage&& other) {
+    chunkList.insert(chunkList.end(), other.chunkList.begin(), other.chunkList.end());
+    byteCount += std::exchange(other.byteCount, 0);
+    other.chunkList.clear();
+  }
+
+  // Copies every chunk in order to out, which must be at least sizeBytes() long.
+  void copyTo(std::byte* out) const {
+    for(auto& c : chunkList) {
+      std::copy(c.data, c.data + c.used, out);
+      out += c.used;
+    }
+  }
+
+protected:
+  struct Chunk {
+    std::byte* data;
+    size_t used;
+  };
+
+  void releaseAll() {
+    for(auto& c : chunkList) {
+      ChunkPool::local().release(c.data);
+    }
+    chunkList.clear();
+    byteCount = 0;
+  }
+
+  std::vector<Chunk> chunkList;
+  size_t byteCount = 0;
+
+};
+
+// class ArenaVector
+// An append-only sequence of trivially copyable elements stored in pooled chunks. Every chunk
+//   but the last is full, so elements are found by index in constant time. Once finished, a
+//   vector may be moved into an ArenaStorage and spliced, but not spliced into.
+template <class T>
+class ArenaVector : public ArenaStorage {
+  static_assert(std::is_trivially_copyable_v<T>, "ArenaVector elements are copied as bytes.");
+
+public:
+  using value_type = T;
+  static constexpr size_t PER_CHUNK = ChunkPool::CHUNK_BYTES / sizeof(T);
+
+  class Iterator {
+  public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = T;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const T*;
+    using reference = const T&;
+
+    Iterator() = default;
+    Iterator(const ArenaVector* owner, size_t index) : owner(owner), index(index) {}
+
+    const T& operator*() const { return (*owner)[index]; }
+    const T* operator->() const { return &(*owner)[index]; }
+    Iterator& operator++() { index++; return *this; }
+    Iterator operator++(int) { auto prev = *this; index++; return prev; }
+    bool operator==(const Iterator& other) const { return index == other.index; }
+
+  private:
+    const ArenaVector* owner = nullptr;
+    size_t index = 0;
+
+  };
+
+  ArenaVector() = default;
+
+  ArenaVector(ArenaVector&& other) noexcept :
+    ArenaStorage(std::move(other)),
+    count(std::exchange(other.count, 0))
+  {
+    //nop
+  }
+
+  ArenaVector& operator=(ArenaVector&& other) noexcept {
+    ArenaStorage::operator=(std::move(other));
+    count = std::exchange(other.count, 0);
+    return *this;
+  }
+
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  T& operator[](size_t i) { return elements(i / PER_CHUNK)[i % PER_CHUNK]; }
+  const T& operator[](size_t i) const { return elements(i / PER_CHUNK)[i % PER_CHUNK]; }
+  T& back() { return (*this)[count - 1]; }
+
+  template <class... Args>
+  T& emplace_back(Args&&... args) {
+    if(count % PER_CHUNK == 0 && count / PER_CHUNK == chunkList.size()) {
+      chunkList.push_back({ ChunkPool::local().acquire(), 0 });
+    }
+    auto& chunk = chunkList[count / PER_CHUNK];
+    T* element = new(chunk.data + chunk.used) T{ std::forward<Args>(args)... };
+    chunk.used += sizeof(T);
+    byteCount += sizeof(T);
+    count++;
+    return *element;
+  }
+
+  void push_back(const T& value) { emplace_back(value); }
+
+  // Only shrinking is supported. Chunks left empty are returned to the pool.
+  void resize(size_t newCount) {
+    if(newCount >= count) { return; }
+    count = newCount;
+    size_t chunksUsed = (count + PER_CHUNK - 1) / PER_CHUNK;
+    while(chunkList.size() > chunksUsed) {
+      ChunkPool::local().release(chunkList.back().data);
+      chunkList.pop_back();
+    }
+    if(!chunkList.empty()) {
+      chunkList.back().used = (count - (chunksUsed - 1) * PER_CHUNK) * sizeof(T);
+    }
+    byteCount = count * sizeof(T);
+  }
+
+  Iterator begin() const { return Iterator(this, 0); }
+  Iterator end() const { return Iterator(this, count); }
+
+private:
+  T* elements(size_t chunk) const { return reinterpret_cast<T*>(chunkList[chunk].data); }
+
+  size_t count = 0;
+
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include "RLE_Inflate.h"
+#include "RLE_Deflate.h"
+#include <coroutine>
+#include <optional>
+#include <type_traits>
+#include <variant>
+
+// class PoolFuture
+// The result of work started on the shared WorkerPool. It can be waited on like a future with
+//   get(), or co_awaited from a coroutine, which is suspended without blocking its thread and
+//   resumed on the worker that finishes the job. The result is taken once, by either means.
+template <class T>
+class PoolFuture {
+public:
+  template <class Func> requires std::is_invocable_r_v<T, Func&>
+  explicit PoolFuture(Func&& work) :
+    state(std::make_shared<State>())
+  {
+    WorkerPool::shared().submit([state = state, work = std::forward<Func>(work)]() mutable {
+      try {
+        if constexpr(std::is_void_v<T>) {
+          work();
+        }
+        else {
+          state->value.emplace(work());
+        }
+      }
+      catch(...) {
+        state->error = std::current_exception();
+      }
+
+      std::coroutine_handle<> waiter;
+      {
+        std::lock_guard lock(state->mutex);
+        state->ready = true;
+        waiter = state->waiter;
+      }
+      state->done.notify_all();
+      if(waiter) { waiter.resume(); }
+    });
+  }
+
+  bool ready() const {
+    std::lock_guard lock(state->mutex);
+    return state->ready;
+  }
+
+  void wait() const {
+    std::unique_lock lock(state->mutex);
+    state->done.wait(lock, [&] { return state->ready; });
+  }
+
+  T get() {
+    wait();
+    return take();
+  }
+
+  bool await_ready() const { return ready(); }
+
+  // Returns false, resuming the caller at once, if the job finished while it was suspending.
+  bool await_suspend(std::coroutine_handle<> caller) {
+    std::lock_guard lock(state->mutex);
+    if(state->ready) { return false; }
+    state->waiter = caller;
+    return true;
+  }
+
+  T await_resume() { return take(); }
+
+private:
+  T take() {
+    if(state->error) {
+      std::rethrow_exception(state->error);
+    }
+    if constexpr(!std::is_void_v<T>) {
+      return std::move(*state->value);
+    }
+  }
+
+  struct State {
+    std::mutex mutex;
+    std::condition_variable done;
+    bool ready = false;
+    std::conditional_t<std::is_void_v<T>, std::monostate, std::optional<T>> value;
+    std::exception_ptr error;
+    std::coroutine_handle<> waiter;
+  };
+
+  std::shared_ptr<State> state;
+
+};
+
+// Runs work() on the shared pool and returns its PoolFuture.
+template <class Func>
+auto runAsync(Func&& work) {
+  return PoolFuture<std::invoke_result_t<Func>>(std::forward<Func>(work));
+}
+
+// Asynchronous forms of deflateFile() and inflateFile(). The caller's thread returns at once,
+//   and the work is cancelled through options.cancellation, while a block is planned or
+//   before one is written, or through cancellation, before a frame is inflated. get() or
+//   co_await then throws OperationCancelled and the partial output is removed.
+PoolFuture<void> deflateFileAsync(std::string inputFilename, std::string outputFilename, DeflateOptions options = {}) {
+  return runAsync([=] { deflateFile(inputFilename, outputFilename, options); });
+}
+
+PoolFuture<void> inflateFileAsync(std::string inputFilename, std::string outputFilename, CancellationToken cancellation = {}) {
+  return runAsync([=] { inflateFile(inputFilename, outputFilename, cancellation); });
+}
+
+// Asynchronous forms for data in memory, which must outlive the returned PoolFuture.
+PoolFuture<std::vector<std::byte>> deflateAsync(std::span<const std::byte> data, DeflateOptions options = {}) {
+  return runAsync([=] {
+    auto plan = planDeflate(data, options);
+    std::vector<std::byte> deflated((size_t)plan.size());
+    plan.write(deflated);
+    return deflated;
+  });
+}
+
+PoolFuture<std::vector<std::byte>> inflateAsync(std::span<const std::byte> rleData, CancellationToken cancellation = {}) {
+  return runAsync([=] {
+    auto frames = readFrames(rleData);
+    std::vector<std::byte> inflated((size_t)totalDecompressedLength(frames));
+    inflateFrames(frames, inflated, true, cancellation);
+    return inflated;
+  });
+}
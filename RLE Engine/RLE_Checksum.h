@@ -0,0 +1,198 @@
+#pragma once
+#include "RLE_Shared.h"
+#include <array>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define RLE_CRC32C_HARDWARE
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define RLE_TARGET_SSE42
+#else
+#define RLE_TARGET_SSE42 __attribute__((target("sse4.2")))
+#endif
+#endif
+
+// CRC32C (Castagnoli) in its reflected form. This is the polynomial implemented by the
+//   SSE4.2 crc32 instruction, so software and hardware results are interchangeable.
+constexpr uint32_t CRC32C_POLY = 0x82F63B78;
+
+// The CRC functions below operate on the raw register. Public checksums are formed by
+//   starting from ~0 and inverting the result, which is what crc32c() does.
+constexpr std::array<uint32_t, 256> makeCrc32cTable() {
+  std::array<uint32_t, 256> table{};
+  for(uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for(int bit = 0; bit < 8; bit++) {
+      crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+constexpr std::array<uint32_t, 256> CRC32C_TABLE = makeCrc32cTable();
+
+#if defined(RLE_CRC32C_HARDWARE)
+bool hasHardwareCrc32c() {
+  static const bool supported = [] {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2") != 0;
+#endif
+  }();
+  return supported;
+}
+
+// Copies len bytes from in to out (when out is not null) while folding them into every
+//   register in crcs, eight bytes per crc32 instruction.
+template <size_t N>
+RLE_TARGET_SSE42 void copyCrc32cHardware(const std::byte* in, size_t len, std::byte* out, std::array<uint32_t, N>& crcs) {
+  std::array<uint64_t, N> wide;
+  for(size_t k = 0; k < N; k++) { wide[k] = crcs[k]; }
+
+  for(; len >= sizeof(uint64_t); len -= sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, in, sizeof(word));
+    if(out) {
+      std::memcpy(out, &word, sizeof(word));
+      out += sizeof(word);
+    }
+    for(auto& crc : wide) { crc = _mm_crc32_u64(crc, word); }
+    in += sizeof(word);
+  }
+
+  for(size_t k = 0; k < N; k++) { crcs[k] = (uint32_t)wide[k]; }
+
+  for(; len > 0; len--) {
+    if(out) { *out++ = *in; }
+    for(auto& crc : crcs) { crc = _mm_crc32_u8(crc, (uint8_t)*in); }
+    in++;
+  }
+}
+#endif
+
+// Copies in to out while folding the copied bytes into every register in crcs.
+// This is the copy kernel used by deflate and inflate when frames carry checksums, so
+//   hashing costs no extra pass over the data. Pass a null out to only hash.
+// Returns the output position following the copied bytes.
+template <size_t N>
+std::byte* copyCrc32c(std::span<const std::byte> in, std::byte* out, std::array<uint32_t, N>& crcs) {
+#if defined(RLE_CRC32C_HARDWARE)
+  if(hasHardwareCrc32c()) {
+    copyCrc32cHardware(in.data(), in.size(), out, crcs);
+    return out ? out + in.size() : out;
+  }
+#endif
+
+  for(auto b : in) {
+    if(out) { *out++ = b; }
+    for(auto& crc : crcs) {
+      crc = (crc >> 8) ^ CRC32C_TABLE[(crc ^ (uint32_t)b) & 0xFF];
+    }
+  }
+  return out;
+}
+
+uint32_t crc32cUpdate(uint32_t crc, std::span<const std::byte> data) {
+  std::array<uint32_t, 1> crcs{ crc };
+  copyCrc32c(data, nullptr, crcs);
+  return crcs[0];
+}
+
+// class Crc32cRepeater
+// Advances a CRC register over a byte repeated any number of times in O(log count).
+// Feeding one byte is the affine map crc' = M(crc) ^ TABLE[value], where M does not
+//   depend on the value. Repeating it n times gives M^n(crc) ^ S_n(TABLE[value]), where
+//   S_n = I + M + ... + M^(n-1). Both M^(2^k) and S_(2^k) are tabulated once, so a run is
+//   applied by walking the set bits of its length.
+class Crc32cRepeater {
+public:
+  static const Crc32cRepeater& instance() {
+    static const Crc32cRepeater repeater;
+    return repeater;
+  }
+
+  uint32_t update(uint32_t crc, std::byte value, uint64_t count) const {
+    uint32_t step = CRC32C_TABLE[(uint32_t)value];
+    for(size_t k = 0; count != 0; k++, count >>= 1) {
+      if(count & 1) {
+        crc = apply(powers[k], crc) ^ apply(sums[k], step);
+      }
+    }
+    return crc;
+  }
+
+private:
+  // A 32x32 matrix over GF(2), stored as the images of each basis bit.
+  using Matrix = std::array<uint32_t, 32>;
+
+  Crc32cRepeater() {
+    // M is the zero-byte update: crc' = (crc >> 8) ^ TABLE[crc & 0xFF]
+    Matrix identity;
+    for(size_t i = 0; i < 32; i++) {
+      uint32_t basis = 1u << i;
+      powers[0][i] = (basis >> 8) ^ CRC32C_TABLE[basis & 0xFF];
+      identity[i] = basis;
+    }
+    sums[0] = identity;
+
+    for(size_t k = 1; k < powers.size(); k++) {
+      // S_(2n) = S_n + M^n * S_n
+      Matrix shifted = multiply(powers[k - 1], sums[k - 1]);
+      for(size_t i = 0; i < 32; i++) {
+        sums[k][i] = sums[k - 1][i] ^ shifted[i];
+      }
+      powers[k] = multiply(powers[k - 1], powers[k - 1]);
+    }
+  }
+
+  static uint32_t apply(const Matrix& m, uint32_t vec) {
+    uint32_t result = 0;
+    for(size_t i = 0; vec != 0; i++, vec >>= 1) {
+      if(vec & 1) { result ^= m[i]; }
+    }
+    return result;
+  }
+
+  static Matrix multiply(const Matrix& a, const Matrix& b) {
+    Matrix result;
+    for(size_t i = 0; i < 32; i++) {
+      result[i] = apply(a, b[i]);
+    }
+    return result;
+  }
+
+  std::array<Matrix, 64> powers; // M^(2^k)
+  std::array<Matrix, 64> sums;   // S_(2^k)
+
+};
+
+uint32_t crc32cUpdate(uint32_t crc, std::byte value, uint64_t count) {
+  return Crc32cRepeater::instance().update(crc, value, count);
+}
+
+uint32_t crc32c(std::span<const std::byte> data) {
+  return ~crc32cUpdate(~0u, data);
+}
+
+// Returns the CRC32C of a message of totalLength bytes after the bytes at offset are changed
+//   from before to after, given its CRC32C beforehand. CRC is linear in the message, so only
+//   the difference is hashed and then carried over the rest of the message in closed form.
+uint32_t crc32cPatch(uint32_t crc, uint64_t totalLength, uint64_t offset, std::span<const std::byte> before, std::span<const std::byte> after) {
+  uint32_t delta = 0;
+  for(size_t i = 0; i < before.size(); i++) {
+    delta = (delta >> 8) ^ CRC32C_TABLE[(delta ^ (uint32_t)(before[i] ^ after[i])) & 0xFF];
+  }
+  return crc ^ crc32cUpdate(delta, std::byte{ 0 }, totalLength - offset - before.size());
+}
+
+uint32_t checksumFile(const std::string& filename) {
+  MappedFile inMap(filename, MappedFile::CreationDisposition::OPEN);
+  auto inView = inMap.getView(0, inMap.size());
+  return crc32c(inView);
+}
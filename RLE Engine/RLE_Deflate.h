@@ -1,11 +1,64 @@
 #pragma once
 #include "RLE_Shared.h"
+#include "RLE_Checksum.h"
+#include "RLE_Arena.h"
+#include "RLE_Entropy.h"
 #include <unordered_map>
 #include <vector>
-#include <future>
+#include <algorithm>
+#include <deque>
+#include <optional>
+#include <cstring>
+
+// How much work deflate spends looking for a smaller encoding. Each level does all the work
+//   of the one before it, plus its own stage:
+//   FASTEST: the node format of each frame is chosen by costing a sample of its runs rather
+//            than all of them, which takes the same time however run-heavy the input is.
+//   DEFAULT: every run is costed in every format.
+//   STRONG:  repeated multi-byte patterns are found as well as runs, and encoded as back
+//            references. Runs which cost more to encode than they save, typically short
+//            runs after a prefix long enough to need skip nodes, are left as literals, and
+//            groups of runs which recur back to back are encoded once with a repeat node.
+//            Literal sections are entropy coded where that saves enough to pay for the
+//            slower decode.
+//   MAX:     each block is split in halves, recursively, while planning the halves apart
+//            makes the output smaller, so regions of different character get their own
+//            formats. This replans the input several times over.
+// Frames which neither runs nor literal coding make smaller are stored verbatim at every level.
+// Measured on one core of a Xeon build host with 4 MiB blocks, over 64 MiB of record-like
+//   data (repeated records, alternating bytes, random bytes and short runs), and over 64 MiB
+//   of word text with zero-filled gaps. Rates are MiB of uncompressed data per second.
+//              record-like data                    word text
+//              ratio  deflate MiB/s  inflate MiB/s ratio  deflate MiB/s  inflate MiB/s
+//   FASTEST    1.04   380            5000          7.5    830            6100
+//   DEFAULT    1.04   400            4900          7.5    840            5700
+//   STRONG     2.42   155            1380          14.4   360            3300
+//   MAX        2.42    80            1250          14.4   200            3500
+//   MAX only gains where the character of the data changes within a block, which neither
+//   corpus does.
+enum class CompressionLevel {
+  FASTEST,
+  DEFAULT,
+  STRONG,
+  MAX
+};
+
+struct DeflateOptions {
+  uint64_t blockSize = 0; // input bytes per frame, or zero to deflate the input as a single frame
+  bool checksums = false; // append a FrameChecksum record to every frame
+  CancellationToken cancellation; // checked while each block is planned and before each is written
+  uint64_t maxMemory = 0; // peak working set deflateFile() may use, or zero for no limit
+  NodeFormat format = NodeFormat::INEFFICIENT; // node format of every frame, or INEFFICIENT to select the best per frame
+  size_t threads = 0; // most threads one call keeps busy, or zero for the whole shared pool
+  CompressionLevel level = CompressionLevel::DEFAULT;
+
+  size_t maxWorkers() const { return threads == 0 ? std::numeric_limits<size_t>::max() : threads; }
+};
+
+template <class NodeVector>
+void parseRun(const Run& run, NodeVector& outVec) {
+  using NodeType = typename NodeVector::value_type;
 
-template <class NodeType>
-void parseRun(const Run& run, std::vector<NodeType>& outVec) {
   //push skip nodes until prefix is within range
   uint64_t prefix = run.prefix;
   while(prefix > NodeType::PrefixMax) {
@@ -13,11 +66,26 @@ void parseRun(const Run& run, std::vector<NodeType>& outVec) {
     prefix -= outVec.back().beSkipNode(prefix);
   }
 
-  //push long nodes until length is within range
+  //push signal & match node pairs for a back reference, which resumes at the same distance
   uint64_t length = run.length;
+  if(run.distance != 0) {
+    while(length > 0) {
+      outVec.emplace_back();
+      outVec.back().beSignalNode((typename NodeType::PrefixType)prefix);
+      prefix = 0;
+      auto matchLength = (typename NodeType::LengthType)std::min<uint64_t>(length, NodeType::LengthMax);
+      outVec.emplace_back();
+      outVec.back().beMatchNode(matchLength, run.distance);
+      length -= matchLength;
+    }
+    return;
+  }
+
+  //push long nodes until length is within range
   while(length > NodeType::LengthMax) {
     outVec.emplace_back();
-    outVec.back().beSignalNode((uint8_t)prefix);
+    outVec.back().beSignalNode((typename NodeType::PrefixType)prefix);
+    prefix = 0; //the signal node carries the prefix, so it must not be repeated
     outVec.emplace_back();
     length -= outVec.back().beLongNode(length, run.value);
   }
@@ -28,26 +96,69 @@ void parseRun(const Run& run, std::vector<NodeType>& outVec) {
   }
 }
 
+// Returns how many bytes at the end of a run of the given length parseRun would leave
+//   unencoded: the remainder after any long nodes, if it is too short to be worth a node.
+template <class NodeType>
+uint64_t unencodableTail(uint64_t length) {
+  constexpr uint64_t maxLongLength = NodeType::LengthMax | ((uint64_t)NodeType::PrefixMax << bitsizeof<typename NodeType::LengthType>());
+
+  uint64_t tail = length;
+  if(tail > NodeType::LengthMax) {
+    tail %= maxLongLength;
+    if(tail > NodeType::LengthMax) { tail = 0; }
+  }
+  return tail <= sizeof(NodeType) ? tail : 0;
+}
+
+// As unencodableTail(), for a back reference: the remainder after whole match nodes, if it
+//   is too short to pay for the pair of nodes it would take.
+template <class NodeType>
+uint64_t unencodableMatchTail(uint64_t length) {
+  uint64_t tail = length % NodeType::LengthMax;
+  return tail <= 2 * sizeof(NodeType) ? tail : 0;
+}
+
+// Folds the unencodable tail of each run back into the literal prefix of the following run,
+//   dropping runs which are left empty. Every byte of the remaining runs is then represented
+//   in the node table.
+template <class NodeType, class RunVector>
+void normalizeRuns(RunVector& runs) {
+  size_t kept = 0;
+  uint64_t carry = 0;
+  for(auto run : runs) {
+    run.prefix += carry;
+    carry = run.distance != 0 ? unencodableMatchTail<NodeType>(run.length) : unencodableTail<NodeType>(run.length);
+    run.length -= carry;
+    if(run.length == 0) {
+      carry += run.prefix;
+      continue;
+    }
+    runs[kept++] = run;
+  }
+  runs.resize(kept);
+}
+
 struct RLETable {
   RLETable() = default;
 
-  template <class NodeType>
-  RLETable(NodeFormat format, int64_t efficiency, const std::vector<NodeType>& nodes) :
+  RLETable(NodeFormat format, int64_t efficiency, uint64_t nodeCount, ArenaStorage&& nodes, uint8_t flags = 0) :
     format(format),
     efficiency(efficiency),
-    nodeCount((uint32_t)nodes.size())
+    nodeCount((uint32_t)nodeCount),
+    nodes(std::move(nodes)),
+    flags(flags)
   {
-    if(nodes.size() > std::numeric_limits<uint32_t>::max()) {
+    if(nodeCount > std::numeric_limits<uint32_t>::max()) {
       throw std::runtime_error("RLE table too large.");
     }
-    std::span<const std::byte> span(reinterpret_cast<const std::byte*>(nodes.data()), std::span(nodes).size_bytes());
-    nodesAsBytes.insert(nodesAsBytes.begin(), span.begin(), span.end());
   }
 
-  NodeFormat format;
-  int64_t efficiency;
-  uint32_t nodeCount;
-  std::vector<std::byte> nodesAsBytes;
+  NodeFormat format = NodeFormat::P8L8;
+  int64_t efficiency = 0; //bytes saved over storing the input verbatim, less the header
+  uint32_t nodeCount = 0;
+  ArenaStorage nodes; // serialized node table, held in the chunks it was built in
+  uint8_t flags = 0; // the FrameFlag bits for the node kinds the table holds
+  std::optional<LiteralCode> literalCode; // set when the literal section is entropy coded
 };
 
 template <class NodeType>
@@ -58,17 +169,23 @@ int64_t calculateRunEfficiencyByFormat(const Run& run) {
   // account for skip nodes
   if(run.prefix > NodeType::PrefixMax) {
     constexpr uint64_t byteMax = std::numeric_limits<uint8_t>::max();
-    constexpr uint64_t maxSkipLength = NodeType::PrefixMax | (byteMax << bitsizeof<NodeType::PrefixType>());
+    constexpr uint64_t maxSkipLength = NodeType::PrefixMax | (byteMax << bitsizeof<typename NodeType::PrefixType>());
     uint64_t maxSkips  = run.prefix / maxSkipLength;
     uint64_t remainder = run.prefix % maxSkipLength;
     nodesGenerated += maxSkips;
     if(remainder > NodeType::PrefixMax) { nodesGenerated++; }
   }
 
+  // account for signal & match node pairs
+  if(run.distance != 0) {
+    nodesGenerated += 2 * ((run.length + NodeType::LengthMax - 1) / NodeType::LengthMax);
+    return run.length - (nodesGenerated * sizeof(NodeType));
+  }
+
   // account for signal & long nodes
   auto length = run.length;
   if(length > NodeType::LengthMax) {
-    constexpr uint64_t longNodeMax = ((uint64_t)NodeType::LengthMax << bitsizeof<NodeType::PrefixType>()) | std::numeric_limits<NodeType::PrefixType>::max();
+    constexpr uint64_t longNodeMax = ((uint64_t)NodeType::LengthMax << bitsizeof<typename NodeType::PrefixType>()) | std::numeric_limits<typename NodeType::PrefixType>::max();
     uint64_t maxLongs  = length / longNodeMax;
     uint64_t remainder = length % longNodeMax;
     nodesGenerated += maxLongs * 2;
@@ -90,8 +207,8 @@ int64_t calculateRunEfficiencyByFormat(const Run& run) {
   return lengthProcessed - (nodesGenerated * sizeof(NodeType));
 }
 
-template <class NodeType>
-int64_t calculateFormatEfficiency(const std::vector<Run>& runs) {
+template <class NodeType, class RunVector>
+int64_t calculateFormatEfficiency(const RunVector& runs) {
   int64_t efficiency = 0;
   for(auto& run : runs) {
     efficiency += calculateRunEfficiencyByFormat<NodeType>(run);
@@ -99,7 +216,8 @@ int64_t calculateFormatEfficiency(const std::vector<Run>& runs) {
   return efficiency;
 }
 
-std::pair<NodeFormat, int64_t> selectFormat(const std::vector<Run>& runs) {
+template <class RunVector>
+std::pair<NodeFormat, int64_t> selectFormat(const RunVector& runs) {
   std::unordered_map<NodeFormat, int64_t> efficiencies{
     { NodeFormat::P8L8,   calculateFormatEfficiency<Node8x8>(runs)   },
     { NodeFormat::P8L16,  calculateFormatEfficiency<Node8x16>(runs)  },
@@ -119,144 +237,982 @@ std::pair<NodeFormat, int64_t> selectFormat(const std::vector<Run>& runs) {
   return std::make_pair(bestFormat, bestEfficiency);
 }
 
-template <class NodeType>
-std::vector<NodeType> parseRunSet(const std::span<const Run>& runs) {
-  std::vector<NodeType> nodes;
-  nodes.reserve(runs.size());
+// Estimates the best format from at most sampleCount runs spread evenly through runs.
+template <class RunVector>
+NodeFormat selectFormatSampled(const RunVector& runs, size_t sampleCount) {
+  size_t step = std::max<size_t>(runs.size() / sampleCount, 1);
+  std::vector<Run> sample;
+  sample.reserve(std::min(runs.size(), sampleCount + 1));
+  for(size_t i = 0; i < runs.size(); i += step) {
+    sample.push_back(runs[i]);
+  }
+  return selectFormat(sample).first;
+}
+
+// Leaves as literals the normalized runs which cost more to encode than they save. Dropping a
+//   run also lengthens the prefix of the run after it, which may then need more skip nodes,
+//   so a run is only dropped when that is a net gain.
+template <class NodeType, class RunVector>
+void pruneRuns(RunVector& runs) {
+  size_t kept = 0;
+  uint64_t carry = 0;
+  for(size_t i = 0; i < runs.size(); i++) {
+    Run run = runs[i];
+    run.prefix += carry;
+    carry = 0;
+
+    int64_t gain = -calculateRunEfficiencyByFormat<NodeType>(run);
+    if(i + 1 < runs.size()) {
+      Run next = runs[i + 1];
+      Run merged = next;
+      merged.prefix += run.prefix + run.length;
+      gain += calculateRunEfficiencyByFormat<NodeType>(merged) - calculateRunEfficiencyByFormat<NodeType>(next);
+    }
+
+    if(gain > 0) {
+      carry = run.prefix + run.length;
+      continue;
+    }
+    runs[kept++] = run;
+  }
+  runs.resize(kept);
+}
+
+// Encodes runs [begin, end) as parseRun() would, except that where the group of up to
+//   RepeatGroupMax runs just encoded recurs straight after, the recurrences take one repeat
+//   node. The group covering the most runs is taken. Only runs from begin on are looked
+//   back at, so ranges may be encoded apart and their nodes joined. Back references are
+//   never repeated, since a copy at another offset might cross a restart point. Returns
+//   whether any repeat node was pushed.
+template <class NodeVector, class RunVector>
+bool parseRunsRepeating(const RunVector& runs, size_t begin, size_t end, NodeVector& outVec, const CancellationToken& cancellation = {}) {
+  using NodeType = typename NodeVector::value_type;
+
+  auto sameRun = [&](size_t a, size_t b) {
+    return runs[a].prefix == runs[b].prefix && runs[a].length == runs[b].length && runs[a].value == runs[b].value &&
+           runs[a].distance == 0 && runs[b].distance == 0;
+  };
+
+  bool repeated = false;
+  size_t nextCheck = begin;
+  for(size_t r = begin; r < end; ) {
+    if(r >= nextCheck) {
+      cancellation.throwIfCancelled();
+      nextCheck = r + CANCELLATION_CHECK_RUNS;
+    }
+    size_t bestGroup = 0;
+    uint64_t bestCount = 0;
+    for(size_t group = 1; group <= NodeType::RepeatGroupMax && group <= r - begin; group++) {
+      uint64_t count = 0;
+      size_t next = r;
+      while(count < NodeType::RepeatCountMax && next + group <= end) {
+        size_t k = 0;
+        while(k < group && sameRun(next - group + k, next + k)) { k++; }
+        if(k < group) { break; }
+        count++;
+        next += group;
+      }
+      if(count * group > bestCount * bestGroup) {
+        bestGroup = group;
+        bestCount = count;
+      }
+    }
+
+    // Every run takes at least one node, so covering two pays for the repeat node.
+    if(bestCount * bestGroup >= 2) {
+      outVec.emplace_back();
+      outVec.back().beRepeatNode(bestGroup, bestCount);
+      r += (size_t)(bestCount * bestGroup);
+      repeated = true;
+      continue;
+    }
+    parseRun(runs[r++], outVec);
+  }
+  return repeated;
+}
+
+template <class NodeType, class RunVector>
+ArenaVector<NodeType> parseRunSet(const RunVector& runs) {
+  ArenaVector<NodeType> nodes;
   for(auto& run : runs) {
     parseRun(run, nodes);
   }
   return nodes;
 }
 
+// Normalizes runs for NodeType, and prunes them when asked, then encodes them as a node
+//   table, splitting the work into threadCount blocks encoded on at most maxWorkers threads.
+//   With repeats, recurring groups of runs are encoded as repeat nodes. The resulting
+//   efficiency is exact rather than estimated.
 template <class NodeType>
-RLETable generateRLETable(NodeFormat format, int64_t efficiency, const std::vector<Run>& runs) {
-  size_t threadCount = 4; //~~@
+RLETable generateRLETable(NodeFormat format, ArenaVector<Run>& runs, size_t threadCount, bool prune = false, bool repeats = false, size_t maxWorkers = std::numeric_limits<size_t>::max(), const CancellationToken& cancellation = {}) {
+  cancellation.throwIfCancelled();
+  normalizeRuns<NodeType>(runs);
+  if(prune) {
+    pruneRuns<NodeType>(runs);
+  }
   size_t runsDist = runs.size() / threadCount;
 
-  std::vector<std::span<const Run>> runBlocks;
-  runBlocks.reserve(threadCount);
-  auto runsIter = runs.begin();
-  //note that loop starts at 1 instead of zero, so that one block is not handled by the loop
-  for(int i = 1; i < threadCount; i++) {
-    auto tail = runsIter + runsDist;
-    runBlocks.emplace_back(runsIter, tail);
-    runsIter = tail;
+  // Each block is encoded into its own arena, and the arenas are then chained in order
+  //   rather than copied together.
+  std::vector<ArenaVector<NodeType>> blockNodes(threadCount);
+  std::vector<char> blockRepeated(threadCount, 0);
+  auto encodeBlock = [&](size_t i) {
+    size_t end = i + 1 == threadCount ? runs.size() : (i + 1) * runsDist;
+    if(repeats) {
+      blockRepeated[i] = parseRunsRepeating(runs, i * runsDist, end, blockNodes[i], cancellation);
+      return;
+    }
+    for(size_t r = i * runsDist; r < end; r++) {
+      if((r - i * runsDist) % CANCELLATION_CHECK_RUNS == 0) { cancellation.throwIfCancelled(); }
+      parseRun(runs[r], blockNodes[i]);
+    }
+  };
+  if(threadCount > 1) {
+    parallelFor(threadCount, encodeBlock, maxWorkers);
+  }
+  else {
+    encodeBlock(0);
   }
-  runBlocks.emplace_back(runsIter, runs.end());
 
-  std::vector<std::future<std::vector<NodeType>>> futures;
-  auto policy = std::launch::async;
-  for(auto& block : runBlocks) {
-    futures.push_back(std::async(policy, parseRunSet<NodeType>, block));
+  ArenaStorage nodes;
+  uint64_t nodeCount = 0;
+  for(auto& block : blockNodes) {
+    nodeCount += block.size();
+    nodes.splice(std::move(block));
   }
 
-  std::vector<NodeType> nodes;
-  nodes.reserve(runs.size());
-  for(auto& fut : futures) {
-    auto block = fut.get();
-    nodes.insert(nodes.end(), block.begin(), block.end());
+  int64_t encodedLength = 0;
+  uint8_t flags = 0;
+  for(auto& run : runs) {
+    encodedLength += run.length;
+    if(run.distance != 0) { flags |= (uint8_t)FrameFlag::MATCHES; }
   }
-  return RLETable(format, efficiency, nodes);
+  if(std::any_of(blockRepeated.begin(), blockRepeated.end(), [](char r) { return r != 0; })) {
+    flags |= (uint8_t)FrameFlag::REPEATS;
+  }
+  return RLETable(format, encodedLength - (int64_t)nodes.sizeBytes(), nodeCount, std::move(nodes), flags);
+}
+
+// Copies the literals of the input segments, as described by nodes, to outIter and returns
+//   the position following them. When crcs is not null, literals are folded into both
+//   registers by the copy kernel and runs into the decompressed one in closed form. outIter
+//   may lie within the input provided it does not run ahead of it, so literals can be
+//   compacted in place. flags are those of the frame, telling which node kinds nodes may hold.
+template <class NodeType>
+std::byte* gatherLiterals(std::span<const NodeType> nodes, uint8_t flags, std::span<const std::span<const std::byte>> inSegments, std::byte* outIter, std::array<uint32_t, 2>* crcs) {
+  SegmentCursor in(inSegments);
+
+  auto copyLiterals = [&](uint64_t count) {
+    in.advance(count, [&](std::span<const std::byte> chunk) {
+      outIter = crcs ? copyCrc32c(chunk, outIter, *crcs) : std::copy(chunk.begin(), chunk.end(), outIter);
+    });
+  };
+  auto skipRun = [&](uint64_t length) {
+    if(crcs && length) {
+      (*crcs)[1] = crc32cUpdate((*crcs)[1], in.current(), length);
+    }
+    in.advance(length, [](std::span<const std::byte>) {});
+  };
+  auto skipMatch = [&](uint64_t length) {
+    in.advance(length, [&](std::span<const std::byte> chunk) {
+      if(crcs) { (*crcs)[1] = crc32cUpdate((*crcs)[1], chunk); }
+    });
+  };
+
+  decodeNodes(nodes, flags, in.remaining(), [&](const Run& run) {
+    copyLiterals(run.prefix);
+    if(run.distance != 0) {
+      skipMatch(run.length);
+    }
+    else {
+      skipRun(run.length);
+    }
+  });
+
+  copyLiterals(in.remaining());
+  return outIter;
 }
 
+// Writes the literal section of a frame whose header and node table are already in place.
+// When checksum is not null, both frame CRCs are accumulated by the literal copy kernel and
+//   stored there. Runs are skipped in the input and hashed in closed form, and back
+//   references are hashed from the input. Given a code, the literals are gathered apart and
+//   coded into place, and the compressed CRC is taken over the coded section instead.
 template <class NodeType>
-void deflateData(MappedFile::View& inView, MappedFile::View& outView) {
-  Header* header = reinterpret_cast<Header*>(outView.data());
+void deflateData(std::span<const std::span<const std::byte>> inSegments, std::span<std::byte> outView, const LiteralCode* code, FrameChecksum* checksum) {
+  const Header* header = reinterpret_cast<const Header*>(outView.data());
   const NodeType* nodesPtr = reinterpret_cast<const NodeType*>(outView.data() + sizeof(Header));
   std::span<const NodeType> nodes(nodesPtr, header->tableNodeCount);
 
-  auto inIter = inView.begin();
-  auto outIter = outView.begin() + sizeof(Header) + nodes.size_bytes();
+  std::array<uint32_t, 2> crcs{ ~0u, ~0u }; // compressed, decompressed
+  if(checksum) {
+    crcs[0] = crc32cUpdate(crcs[0], outView.first(sizeof(Header) + nodes.size_bytes()));
+  }
 
-  bool longNode = false;
-  for(auto& node : nodes) {
-    if(longNode) {
-      inIter += node.getLongLength();
-      longNode = false;
-      continue;
+  std::byte* literalsOut = outView.data() + sizeof(Header) + nodes.size_bytes();
+  if(code) {
+    std::vector<std::byte> literals((size_t)code->literalCount);
+    gatherLiterals(nodes, header->flags(), inSegments, literals.data(), checksum ? &crcs : nullptr);
+    encodeLiterals(literals, *code, std::span(literalsOut, (size_t)code->size()));
+    if(checksum) {
+      crcs[0] = crc32cUpdate(~0u, outView.first(sizeof(Header) + nodes.size_bytes() + (size_t)code->size()));
     }
+  }
+  else {
+    gatherLiterals(nodes, header->flags(), inSegments, literalsOut, checksum ? &crcs : nullptr);
+  }
 
-    size_t prefix = node.prefix;
-    if(node.length == 0) {
-      if(node.value == (std::byte)0) {
-        longNode = true;
-      }
-      else {
-        prefix = node.getSkipLength();
-      }
-    }
+  if(checksum) {
+    checksum->compressed = ~crcs[0];
+    checksum->decompressed = ~crcs[1];
+  }
+}
 
-    auto inTail = inIter + prefix;
-    outIter = std::copy(inIter, inTail, outIter);
-    //tailIter is past the prefix, add the run length to that to get the new inIter
-    inIter = inTail + node.length;
+std::byte* gatherLiteralsByFormat(NodeFormat format, std::span<const std::byte> nodes, uint32_t nodeCount, uint8_t flags, std::span<const std::span<const std::byte>> inSegments, std::byte* outIter, std::array<uint32_t, 2>* crcs) {
+  switch(format) {
+  case NodeFormat::P8L8:   return gatherLiterals(std::span(reinterpret_cast<const Node8x8*  >(nodes.data()), nodeCount), flags, inSegments, outIter, crcs);
+  case NodeFormat::P8L16:  return gatherLiterals(std::span(reinterpret_cast<const Node8x16* >(nodes.data()), nodeCount), flags, inSegments, outIter, crcs);
+  case NodeFormat::P16L8:  return gatherLiterals(std::span(reinterpret_cast<const Node16x8* >(nodes.data()), nodeCount), flags, inSegments, outIter, crcs);
+  case NodeFormat::P16L16: return gatherLiterals(std::span(reinterpret_cast<const Node16x16*>(nodes.data()), nodeCount), flags, inSegments, outIter, crcs);
+  default: throw std::logic_error("Failed switch to format.");
   }
+}
+
+// Counts the byte values of the literals which runs leave in block, apart for each literal
+//   stream.
+std::array<LiteralHistogram, LITERAL_STREAMS> countLiterals(std::span<const std::span<const std::byte>> block, const ArenaVector<Run>& runs, uint64_t literalCount) {
+  std::array<LiteralHistogram, LITERAL_STREAMS> histograms{};
+  uint64_t share = literalStreamShare(literalCount);
+  uint64_t literal = 0;
+  SegmentCursor in(block);
+  auto count = [&](uint64_t length) {
+    in.advance(length, [&](std::span<const std::byte> piece) {
+      while(!piece.empty()) {
+        size_t stream = (size_t)(literal / share);
+        auto part = piece.first((size_t)std::min<uint64_t>(piece.size(), (stream + 1) * share - literal));
+        for(auto value : part) {
+          histograms[stream][(uint8_t)value]++;
+        }
+        literal += part.size();
+        piece = piece.subspan(part.size());
+      }
+    });
+  };
 
-  std::copy(inIter, inView.end(), outIter);
+  for(auto& run : runs) {
+    count(run.prefix);
+    in.advance(run.length, [](std::span<const std::byte>) {});
+  }
+  count(in.remaining());
+  return histograms;
 }
 
-std::vector<Run> collectRuns(const std::span<const std::byte>& data) { //~~@ thread this
-  std::vector<Run> runs;
-  runs.reserve(data.size() >> 10);
+// Entropy codes the literal section of the frame for block, which runs leave as literals,
+//   when that saves enough. The saving is costed exactly and added to the efficiency of table.
+void planLiteralCoding(std::span<const std::span<const std::byte>> block, const ArenaVector<Run>& runs, RLETable& table) {
+  uint64_t literalCount = segmentsLength(block);
+  for(auto& run : runs) {
+    literalCount -= run.length;
+  }
 
-  Run run;
-  size_t prevTailPos = 0;
-  for(size_t i = 0; i < data.size(); ) {
-    auto position = i;
-    run.length = 1;
-    run.value = data[i];
+  auto code = planLiteralCode(countLiterals(block, runs, literalCount));
+  if(!code) { return; }
+  table.efficiency += (int64_t)(literalCount - code->size());
+  table.flags |= (uint8_t)FrameFlag::CODED_LITERALS;
+  table.literalCode = std::move(code);
+}
 
-    while((++i < data.size()) && (data[i] == run.value)) {
-      run.length++;
-    }
+// Runs are collected across segment boundaries, so the segments behave as one stream. Long
+//   segments are measured in slices, between which cancellation is checked.
+ArenaVector<Run> collectRuns(std::span<const std::span<const std::byte>> segments, const CancellationToken& cancellation = {}) { //~~@ thread this
+  ArenaVector<Run> runs;
 
+  Run run{};
+  uint64_t position = 0; // of the run being measured, within the stream
+  uint64_t prevTailPos = 0;
+  auto finishRun = [&] {
     if(run.length > sizeof(Node8x8)) {
       run.prefix = position - prevTailPos;
       runs.push_back(run);
       prevTailPos = position + run.length;
     }
+  };
+
+  uint64_t base = 0;
+  for(auto& segment : segments) {
+    for(size_t slice = 0; slice < segment.size(); slice += (size_t)CANCELLATION_CHECK_BYTES) {
+      cancellation.throwIfCancelled();
+      auto data = segment.subspan(slice, (size_t)std::min<uint64_t>(segment.size() - slice, CANCELLATION_CHECK_BYTES));
+      size_t i = 0;
+      while(i < data.size() && run.length != 0 && data[i] == run.value) { //continued from the previous slice
+        run.length++;
+        i++;
+      }
+
+      while(i < data.size()) {
+        finishRun();
+        position = base + i;
+        run.length = 1;
+        run.value = data[i];
+
+        while((++i < data.size()) && (data[i] == run.value)) {
+          run.length++;
+        }
+      }
+      base += data.size();
+    }
   }
+  finishRun();
 
   return runs;
 }
 
-void deflateFile(const std::string& inputFilename, const std::string& outputFilename) {
-  MappedFile inMap(inputFilename, MappedFile::CreationDisposition::OPEN);
-  auto inView = inMap.getView(0, inMap.size());
+ArenaVector<Run> collectRuns(const std::span<const std::byte>& data, const CancellationToken& cancellation = {}) {
+  return collectRuns(std::span<const std::span<const std::byte>>(&data, 1), cancellation);
+}
+
+// Back references are found by hashing the MIN_MATCH bytes at each position into a table of
+//   2^MATCH_HASH_BITS positions.
+constexpr size_t MATCH_HASH_BITS = 12;
+constexpr size_t MIN_MATCH = sizeof(uint32_t);
+// A window holds this many bytes past its interval: enough for the last lookups, and enough
+//   that a run from the interval which reaches the window's end is long enough to collect.
+constexpr size_t MATCH_LOOKAHEAD = std::max(MIN_MATCH - 1, sizeof(Node8x8) + 1);
+
+// Searches one restart interval for collectMatches(), from w up to limit. window starts with
+//   the interval and holds the MATCH_LOOKAHEAD bytes after it, if there are any; positions in
+//   it are relative to windowStart, as are those in lastSeen. A run reaching the end of window
+//   is measured on by runEnd.
+template <class RunEndFunc>
+void collectWindowMatches(std::span<const std::byte> window, size_t limit, size_t w, uint64_t windowStart, uint64_t& literalStart, uint32_t* lastSeen, ArenaVector<Run>& runs, RunEndFunc&& runEnd) {
+  const std::byte* data = window.data();
+  size_t size = window.size();
+  while(w < limit) {
+    size_t end = w + 1;
+    while(end < size && data[end] == data[w]) { end++; }
+    if(end - w > sizeof(Node8x8)) {
+      uint64_t runStop = end == size ? runEnd(windowStart + end, data[w]) : windowStart + end;
+      runs.push_back({ windowStart + w - literalStart, runStop - (windowStart + w), data[w] });
+      literalStart = runStop;
+      if(runStop - windowStart >= limit) { return; }
+      w = (size_t)(runStop - windowStart);
+      continue;
+    }
+
+    if(w + MIN_MATCH <= size) {
+      uint32_t sequence;
+      std::memcpy(&sequence, data + w, sizeof(sequence));
+      uint32_t candidate = std::exchange(lastSeen[(sequence * 2654435761u) >> (32 - MATCH_HASH_BITS)], (uint32_t)w);
+      // An empty slot lies after every position, so its distance wraps past the window.
+      uint64_t distance = (uint64_t)w - candidate;
+      if(distance <= MATCH_WINDOW && std::memcmp(data + candidate, data + w, MIN_MATCH) == 0) {
+        size_t matchEnd = w + MIN_MATCH;
+        while(matchEnd < limit && data[matchEnd] == data[matchEnd - distance]) { matchEnd++; }
+        if(matchEnd - w > 2 * sizeof(Node8x8)) {
+          runs.push_back({ windowStart + w - literalStart, matchEnd - w, std::byte{ 0 }, (uint32_t)distance });
+          literalStart = windowStart + matchEnd;
+          w = matchEnd;
+          continue;
+        }
+      }
+    }
+    w++;
+  }
+}
+
+// Collects runs as collectRuns() does, and between them back references: stretches which
+//   repeat the content up to MATCH_WINDOW bytes before them, such as ABABAB or a record
+//   repeating the last. Candidates come from a hash table of where each 4 byte sequence was
+//   last seen, so each byte not in a run or reference costs one lookup. References are kept
+//   within their restart interval, and only those longer than the pair of nodes they take
+//   in the smallest format are collected.
+// References never reach outside their restart interval, so the segments are searched an
+//   interval at a time. Only an interval which spans segments is copied together, and only
+//   runs are measured past it, so the result is the same however the stream is divided.
+//   cancellation is checked before each interval.
+ArenaVector<Run> collectMatches(std::span<const std::span<const std::byte>> segments, const CancellationToken& cancellation = {}) {
+  // Positions only move forward, so the segment holding one is found from the last.
+  uint64_t size = segmentsLength(segments);
+  size_t segment = 0;
+  uint64_t segmentStart = 0;
+  auto seek = [&](uint64_t position) {
+    while(segmentStart + segments[segment].size() <= position) {
+      segmentStart += segments[segment++].size();
+    }
+  };
+  std::vector<std::byte> joined;
+  auto contiguous = [&](uint64_t position, uint64_t length) {
+    seek(position);
+    auto offset = (size_t)(position - segmentStart);
+    if(offset + length <= segments[segment].size()) {
+      return segments[segment].subspan(offset, (size_t)length);
+    }
+    joined.resize((size_t)length);
+    auto out = std::span(joined);
+    for(size_t s = segment; !out.empty(); s++, offset = 0) {
+      auto piece = segments[s].subspan(offset).first(std::min(out.size(), segments[s].size() - offset));
+      std::memcpy(out.data(), piece.data(), piece.size());
+      out = out.subspan(piece.size());
+    }
+    return std::span<const std::byte>(joined);
+  };
+  auto runEnd = [&](uint64_t position, std::byte value) {
+    if(position == size) { return position; }
+    seek(position);
+    auto offset = (size_t)(position - segmentStart);
+    for(size_t s = segment; s < segments.size(); s++, offset = 0) {
+      auto piece = segments[s].subspan(offset);
+      auto other = std::find_if(piece.begin(), piece.end(), [&](std::byte b) { return b != value; });
+      position += (uint64_t)(other - piece.begin());
+      if(other != piece.end()) { break; }
+    }
+    return position;
+  };
+
+  ArenaVector<Run> runs;
+  std::vector<uint32_t> lastSeen(size_t{ 1 } << MATCH_HASH_BITS);
+  uint64_t literalStart = 0;
+  uint64_t i = 0;
+  while(i < size) {
+    cancellation.throwIfCancelled();
+    // None of the positions seen before an interval may be referred to from it.
+    uint64_t windowStart = i / MATCH_RESTART_INTERVAL * MATCH_RESTART_INTERVAL;
+    uint64_t intervalEnd = std::min(size, windowStart + MATCH_RESTART_INTERVAL);
+    auto window = contiguous(windowStart, std::min(size, intervalEnd + MATCH_LOOKAHEAD) - windowStart);
+    auto limit = (size_t)(intervalEnd - windowStart);
+    std::fill(lastSeen.begin(), lastSeen.end(), std::numeric_limits<uint32_t>::max());
+    collectWindowMatches(window, limit, (size_t)(i - windowStart), windowStart, literalStart, lastSeen.data(), runs, runEnd);
+    i = std::max(literalStart, intervalEnd);
+  }
+  return runs;
+}
+
+ArenaVector<Run> collectMatches(const std::span<const std::byte>& data, const CancellationToken& cancellation = {}) {
+  return collectMatches(std::span<const std::span<const std::byte>>(&data, 1), cancellation);
+}
 
-  std::vector<Run> runs = collectRuns(inView);
+// The table of a block of at least SPLIT_TABLE_THRESHOLD bytes is encoded in
+//   SPLIT_TABLE_PIECES pieces, so it may be spread over workers. Repeat nodes only look back
+//   within their piece, so the count depends on the block's length alone, never on how many
+//   workers there are, and every entry point deflating the same blocks gets the same frames.
+constexpr uint64_t SPLIT_TABLE_THRESHOLD = 1 << 20;
+constexpr size_t SPLIT_TABLE_PIECES = 4;
 
-  auto selection = selectFormat(runs);
-  auto format = selection.first;
-  auto efficiency = selection.second;
+size_t tablePieces(uint64_t blockLength) {
+  return blockLength >= SPLIT_TABLE_THRESHOLD ? SPLIT_TABLE_PIECES : 1;
+}
+
+// Collects the runs in block and encodes them in the most efficient node format, as far as
+//   level looks for it. Given a format, the block is encoded in that one without costing the
+//   others. The table is encoded in threadCount pieces on at most maxWorkers threads.
+//   cancellation is checked as the runs are collected and encoded.
+// A block without worthwhile runs gets an empty table, so its frame stores it verbatim, or
+//   from STRONG on, perhaps entropy coded.
+RLETable planFrame(std::span<const std::span<const std::byte>> block, size_t threadCount, NodeFormat format = NodeFormat::INEFFICIENT, CompressionLevel level = CompressionLevel::DEFAULT, size_t maxWorkers = std::numeric_limits<size_t>::max(), const CancellationToken& cancellation = {}) {
+  constexpr size_t FORMAT_SAMPLE_RUNS = 1 << 12;
+
+  bool strong = level >= CompressionLevel::STRONG;
+  auto runs = strong ? collectMatches(block, cancellation) : collectRuns(block, cancellation);
+  if(format == NodeFormat::INEFFICIENT) {
+    format = level == CompressionLevel::FASTEST ? selectFormatSampled(runs, FORMAT_SAMPLE_RUNS) : selectFormat(runs).first;
+  }
 
   RLETable table;
   switch(format) {
-  case NodeFormat::P8L8:   table = generateRLETable<Node8x8  >(format, efficiency, runs); break;
-  case NodeFormat::P8L16:  table = generateRLETable<Node8x16 >(format, efficiency, runs); break;
-  case NodeFormat::P16L8:  table = generateRLETable<Node16x8 >(format, efficiency, runs); break;
-  case NodeFormat::P16L16: table = generateRLETable<Node16x16>(format, efficiency, runs); break;
-  case NodeFormat::INEFFICIENT: throw std::runtime_error("Cannot deflate this file efficiently.");
+  case NodeFormat::P8L8:   table = generateRLETable<Node8x8  >(format, runs, threadCount, strong, strong, maxWorkers, cancellation); break;
+  case NodeFormat::P8L16:  table = generateRLETable<Node8x16 >(format, runs, threadCount, strong, strong, maxWorkers, cancellation); break;
+  case NodeFormat::P16L8:  table = generateRLETable<Node16x8 >(format, runs, threadCount, strong, strong, maxWorkers, cancellation); break;
+  case NodeFormat::P16L16: table = generateRLETable<Node16x16>(format, runs, threadCount, strong, strong, maxWorkers, cancellation); break;
+  case NodeFormat::INEFFICIENT: break;
   };
 
-  uint64_t compressedLength = inMap.size() - table.efficiency + sizeof(Header);
-  MappedFile outMap(outputFilename, MappedFile::CreationDisposition::CREATE, compressedLength);
-  auto outView = outMap.getView(0, outMap.size());
+  if(table.efficiency <= 0) {
+    table = RLETable();
+    runs.resize(0);
+  }
+  if(strong) {
+    planLiteralCoding(block, runs, table);
+  }
+  return table;
+}
 
-  Header* header = new(outView.data()) Header;
-  header->setNodeFormat(format);
-  header->decompressedLength = inMap.size();
+RLETable planFrame(const std::span<const std::byte>& block, size_t threadCount, NodeFormat format = NodeFormat::INEFFICIENT, CompressionLevel level = CompressionLevel::DEFAULT, size_t maxWorkers = std::numeric_limits<size_t>::max(), const CancellationToken& cancellation = {}) {
+  return planFrame(std::span<const std::span<const std::byte>>(&block, 1), threadCount, format, level, maxWorkers, cancellation);
+}
+
+uint64_t frameLength(const RLETable& table, uint64_t blockLength, bool checksums) {
+  return sizeof(Header) + blockLength - table.efficiency + (checksums ? sizeof(FrameChecksum) : 0);
+}
+
+// Writes the frame for block into out, which must be exactly frameLength() bytes long.
+void writeFrame(std::span<const std::span<const std::byte>> block, const RLETable& table, std::span<std::byte> out, bool checksums) {
+  Header* header = new(out.data()) Header;
+  header->setNodeFormat(table.format);
+  if(checksums) { header->setFlag(FrameFlag::CHECKSUM); }
+  header->setFlags(table.flags);
+  header->decompressedLength = segmentsLength(block);
   header->tableNodeCount = table.nodeCount;
+  table.nodes.copyTo(out.data() + sizeof(Header));
 
-  auto outIter = outView.begin() + sizeof(Header);
-  std::copy(table.nodesAsBytes.begin(), table.nodesAsBytes.end(), outIter);
+  const LiteralCode* code = table.literalCode ? &*table.literalCode : nullptr;
+  FrameChecksum* checksum = nullptr;
+  if(checksums) {
+    out = out.first(out.size() - sizeof(FrameChecksum));
+    checksum = reinterpret_cast<FrameChecksum*>(out.data() + out.size());
+  }
 
-  switch(format) {
-  case NodeFormat::P8L8:   deflateData<Node8x8  >(inView, outView); break;
-  case NodeFormat::P8L16:  deflateData<Node8x16 >(inView, outView); break;
-  case NodeFormat::P16L8:  deflateData<Node16x8 >(inView, outView); break;
-  case NodeFormat::P16L16: deflateData<Node16x16>(inView, outView); break;
+  switch(table.format) {
+  case NodeFormat::P8L8:   deflateData<Node8x8  >(block, out, code, checksum); break;
+  case NodeFormat::P8L16:  deflateData<Node8x16 >(block, out, code, checksum); break;
+  case NodeFormat::P16L8:  deflateData<Node16x8 >(block, out, code, checksum); break;
+  case NodeFormat::P16L16: deflateData<Node16x16>(block, out, code, checksum); break;
   default: throw std::logic_error("Failed switch to format.");
   }
 }
+
+void writeFrame(const std::span<const std::byte>& block, const RLETable& table, std::span<std::byte> out, bool checksums) {
+  writeFrame(std::span<const std::span<const std::byte>>(&block, 1), table, out, checksums);
+}
+
+std::vector<std::span<const std::byte>> splitBlocks(std::span<const std::byte> data, uint64_t blockSize) {
+  if(blockSize == 0 || blockSize >= data.size()) {
+    return { data };
+  }
+
+  std::vector<std::span<const std::byte>> blocks;
+  blocks.reserve((size_t)((data.size() + blockSize - 1) / blockSize));
+  while(!data.empty()) {
+    size_t length = (size_t)std::min<uint64_t>(blockSize, data.size());
+    blocks.push_back(data.first(length));
+    data = data.subspan(length);
+  }
+  return blocks;
+}
+
+struct SplitBlock {
+  uint64_t offset; // within the block which was split
+  uint64_t length;
+  RLETable table;
+};
+
+// Splits block in halves, recursively, while planning the halves apart makes their frames
+//   shorter than the frame of the whole, and appends each resulting block with its table.
+//   offset is that of block within the block first given.
+void splitWhileSmaller(std::span<const std::span<const std::byte>> block, RLETable&& table, const DeflateOptions& options, std::vector<SplitBlock>& out, uint64_t offset = 0) {
+  constexpr size_t MIN_SPLIT_BLOCK = 1 << 16;
+
+  uint64_t length = segmentsLength(block);
+  if(length >= 2 * MIN_SPLIT_BLOCK) {
+    uint64_t leftLength = length / 2;
+    auto left = sliceSegments(block, 0, leftLength);
+    auto right = sliceSegments(block, leftLength, length - leftLength);
+    auto leftTable = planFrame(left, 1, options.format, options.level, 1, options.cancellation);
+    auto rightTable = planFrame(right, 1, options.format, options.level, 1, options.cancellation);
+    if(frameLength(leftTable, leftLength, options.checksums) + frameLength(rightTable, length - leftLength, options.checksums) < frameLength(table, length, options.checksums)) {
+      splitWhileSmaller(left, std::move(leftTable), options, out, offset);
+      splitWhileSmaller(right, std::move(rightTable), options, out, offset + leftLength);
+      return;
+    }
+  }
+  out.push_back({ offset, length, std::move(table) });
+}
+
+// struct DeflatePlan
+// The frames an input will be deflated into: one block of input and one node table per frame,
+//   and where each frame lands relative to the start of the output.
+struct DeflatePlan {
+  std::vector<std::span<const std::byte>> blocks;
+  std::vector<RLETable> tables;
+  std::vector<uint64_t> offsets{ 0 }; // one per frame, plus the total length
+  bool checksums = false;
+  CancellationToken cancellation;
+  size_t maxWorkers = std::numeric_limits<size_t>::max();
+
+  uint64_t size() const { return offsets.back(); }
+
+  bool compressible() const {
+    return std::any_of(tables.begin(), tables.end(), [](const RLETable& table) { return table.nodeCount != 0 || table.literalCode; });
+  }
+
+  std::span<std::byte> frame(size_t i, std::span<std::byte> out) const {
+    return out.subspan((size_t)offsets[i], (size_t)(offsets[i + 1] - offsets[i]));
+  }
+
+  // Writes every frame into out, which must be exactly size() bytes long.
+  void write(std::span<std::byte> out) const {
+    parallelFor(blocks.size(), [&](size_t i) {
+      cancellation.throwIfCancelled();
+      writeFrame(blocks[i], tables[i], frame(i, out), checksums);
+    }, maxWorkers);
+  }
+};
+
+// Splits every input into blocks and builds the node table of each, scheduling all blocks of
+//   all inputs as one stream of work on the shared pool. Small inputs are thereby packed
+//   together and large ones spread over the workers block by block. The pieces of a large
+//   block's table run on the share of maxWorkers which the other items leave it, so that
+//   nesting never runs more than maxWorkers threads.
+std::vector<DeflatePlan> planDeflateBatch(std::span<const std::span<const std::byte>> inputs, const DeflateOptions& options, size_t maxWorkers = std::numeric_limits<size_t>::max()) {
+  maxWorkers = std::min(maxWorkers, options.maxWorkers());
+  std::vector<DeflatePlan> plans(inputs.size());
+  std::vector<std::pair<size_t, size_t>> items; // input, block
+  for(size_t i = 0; i < inputs.size(); i++) {
+    auto& plan = plans[i];
+    plan.checksums = options.checksums;
+    plan.cancellation = options.cancellation;
+    plan.maxWorkers = maxWorkers;
+    if(inputs[i].empty()) { continue; }
+
+    plan.blocks = splitBlocks(inputs[i], options.blockSize);
+    plan.tables.resize(plan.blocks.size());
+    for(size_t b = 0; b < plan.blocks.size(); b++) {
+      items.emplace_back(i, b);
+    }
+  }
+
+  // Each item runs on one of at most outerWorkers threads, and may borrow innerWorkers - 1 more.
+  size_t outerWorkers = std::max<size_t>(std::min({ items.size(), WorkerPool::shared().size() + 1, maxWorkers }), 1);
+  size_t innerWorkers = std::max<size_t>(std::min(WorkerPool::shared().size() + 1, maxWorkers) / outerWorkers, 1);
+  parallelFor(items.size(), [&](size_t k) {
+    options.cancellation.throwIfCancelled();
+    auto& plan = plans[items[k].first];
+    size_t b = items[k].second;
+    plan.tables[b] = planFrame(plan.blocks[b], tablePieces(plan.blocks[b].size()), options.format, options.level, innerWorkers, options.cancellation);
+  }, maxWorkers);
+
+  if(options.level == CompressionLevel::MAX) {
+    std::vector<std::vector<SplitBlock>> refined(items.size());
+    parallelFor(items.size(), [&](size_t k) {
+      options.cancellation.throwIfCancelled();
+      auto& plan = plans[items[k].first];
+      size_t b = items[k].second;
+      splitWhileSmaller(std::span(&plan.blocks[b], 1), std::move(plan.tables[b]), options, refined[k]);
+    }, maxWorkers);
+
+    std::vector<std::vector<std::span<const std::byte>>> unsplit(plans.size());
+    for(size_t i = 0; i < plans.size(); i++) {
+      unsplit[i] = std::move(plans[i].blocks);
+      plans[i].blocks.clear();
+      plans[i].tables.clear();
+    }
+    for(size_t k = 0; k < items.size(); k++) {
+      auto& plan = plans[items[k].first];
+      auto& block = unsplit[items[k].first][items[k].second];
+      for(auto& split : refined[k]) {
+        plan.blocks.push_back(block.subspan((size_t)split.offset, (size_t)split.length));
+        plan.tables.push_back(std::move(split.table));
+      }
+    }
+  }
+
+  for(auto& plan : plans) {
+    plan.offsets.reserve(plan.blocks.size() + 1);
+    for(size_t b = 0; b < plan.blocks.size(); b++) {
+      plan.offsets.push_back(plan.offsets.back() + frameLength(plan.tables[b], plan.blocks[b].size(), options.checksums));
+    }
+  }
+  return plans;
+}
+
+DeflatePlan planDeflate(std::span<const std::byte> data, const DeflateOptions& options) {
+  return std::move(planDeflateBatch(std::span(&data, 1), options).front());
+}
+
+// Writes each plan into the matching output, which must be exactly its size() bytes long.
+//   Every frame of every plan is one item of work on the shared pool.
+void writeBatch(std::span<const DeflatePlan> plans, std::span<const std::span<std::byte>> outs) {
+  std::vector<std::pair<size_t, size_t>> items; // plan, frame
+  size_t maxWorkers = std::numeric_limits<size_t>::max();
+  for(size_t i = 0; i < plans.size(); i++) {
+    for(size_t f = 0; f < plans[i].blocks.size(); f++) {
+      items.emplace_back(i, f);
+    }
+    maxWorkers = std::min(maxWorkers, plans[i].maxWorkers);
+  }
+
+  parallelFor(items.size(), [&](size_t k) {
+    auto& plan = plans[items[k].first];
+    plan.cancellation.throwIfCancelled();
+    size_t f = items[k].second;
+    writeFrame(plan.blocks[f], plan.tables[f], plan.frame(f, outs[items[k].first]), plan.checksums);
+  }, maxWorkers);
+}
+
+// Upper bound on the heap used while planning a block, per byte of the block. The worst case
+//   is a run every four bytes, each taking 24 bytes as a Run and up to 5 as a node. Arenas
+//   never hold more than one copy of either.
+constexpr uint64_t PLAN_BYTES_PER_BLOCK_BYTE = 8;
+
+// Arena chunks each worker may hold beyond its share of the block: the partly filled last
+//   chunk of its run and node arenas, and the chunks retained by its ChunkPool.
+constexpr uint64_t BUDGET_BYTES_PER_WORKER = (ChunkPool::MAX_RETAINED + 6) * ChunkPool::CHUNK_BYTES;
+
+// A block in flight under a memory budget also holds its finished table, its views of the
+//   input and output, and while it is written, any literals gathered to be entropy coded.
+constexpr uint64_t BUDGET_BYTES_PER_BLOCK_BYTE = PLAN_BYTES_PER_BLOCK_BYTE + 4;
+
+// Upper bound on a finished table, per byte of its block: up to 5 bytes of nodes for a run
+//   every four bytes, rounded up.
+constexpr uint64_t TABLE_BYTES_PER_BLOCK_BYTE = 2;
+
+// Under MAX, splitWhileSmaller() holds, besides the table of the whole block, the tables of
+//   the halves it has yet to descend into and of the blocks it has finished. Each set covers
+//   the block at most once.
+constexpr uint64_t SPLIT_BYTES_PER_BLOCK_BYTE = 2 * TABLE_BYTES_PER_BLOCK_BYTE;
+
+uint64_t budgetBytesPerBlockByte(CompressionLevel level) {
+  return BUDGET_BYTES_PER_BLOCK_BYTE + (level == CompressionLevel::MAX ? SPLIT_BYTES_PER_BLOCK_BYTE : 0);
+}
+
+struct BudgetLayout {
+  uint64_t blockSize;
+  size_t workers; // blocks in flight at once
+};
+
+// Picks the largest block size (no larger than options.blockSize, when set) and then the most
+//   workers that keep deflating an input of inputLength bytes within options.maxMemory.
+BudgetLayout layoutForBudget(const DeflateOptions& options, uint64_t inputLength) {
+  constexpr uint64_t MIN_BLOCK_SIZE = 1 << 16;
+
+  uint64_t bytesPerBlockByte = budgetBytesPerBlockByte(options.level);
+  uint64_t maxBlockSize = options.maxMemory > BUDGET_BYTES_PER_WORKER ? (options.maxMemory - BUDGET_BYTES_PER_WORKER) / bytesPerBlockByte : 0;
+  if(maxBlockSize < MIN_BLOCK_SIZE) {
+    throw std::runtime_error("Memory budget is too small to deflate within.");
+  }
+
+  BudgetLayout layout;
+  layout.blockSize = std::min({ options.blockSize == 0 ? inputLength : options.blockSize, maxBlockSize, std::max<uint64_t>(inputLength, 1) });
+  layout.workers = (size_t)std::clamp<uint64_t>(options.maxMemory / (layout.blockSize * bytesPerBlockByte + BUDGET_BYTES_PER_WORKER), 1, WorkerPool::shared().size() + 1);
+  return layout;
+}
+
+// Deflates inMap a window of blocks at a time, mapping only the window of input and output
+//   in use, so the working set stays within options.maxMemory whatever the file size. The
+//   output is created through cleanup, which is left for the caller to commit once it has
+//   decided to keep the result.
+// Returns whether any frame was compressible.
+bool deflateWithinBudget(MappedFile& inMap, const std::string& outputFilename, OutputCleanup& cleanup, const DeflateOptions& options) {
+  auto layout = layoutForBudget(options, inMap.size());
+  uint64_t windowLength = layout.blockSize * layout.workers;
+  DeflateOptions windowOptions = options;
+  windowOptions.blockSize = layout.blockSize;
+
+  bool compressible = false;
+  uint64_t outLength = 0;
+  for(uint64_t offset = 0; offset < inMap.size(); offset += windowLength) {
+    auto inView = inMap.getView(offset, (size_t)std::min(windowLength, inMap.size() - offset));
+    std::span<const std::byte> window = inView;
+    auto plan = std::move(planDeflateBatch(std::span(&window, 1), windowOptions, layout.workers).front());
+    compressible = compressible || plan.compressible();
+
+    auto disposition = offset == 0 ? MappedFile::CreationDisposition::CREATE : MappedFile::CreationDisposition::OPEN;
+    MappedFile outMap(outputFilename, disposition, outLength + plan.size());
+    cleanup.created();
+    auto outView = outMap.getView(outLength, (size_t)plan.size());
+    plan.write(outView);
+    outLength += plan.size();
+  }
+  return compressible;
+}
+
+void deflateFile(const std::string& inputFilename, const std::string& outputFilename, const DeflateOptions& options = {}) {
+  MappedFile inMap(inputFilename, MappedFile::CreationDisposition::OPEN);
+
+  if(options.maxMemory != 0) {
+    OutputCleanup cleanup(outputFilename);
+    if(!deflateWithinBudget(inMap, outputFilename, cleanup, options)) {
+      throw std::runtime_error("Cannot deflate this file efficiently.");
+    }
+    cleanup.commit();
+    return;
+  }
+
+  auto inView = inMap.getView(0, inMap.size());
+
+  auto plan = planDeflate(inView, options);
+  if(!plan.compressible()) {
+    throw std::runtime_error("Cannot deflate this file efficiently.");
+  }
+
+  OutputCleanup cleanup(outputFilename);
+  MappedFile outMap(outputFilename, MappedFile::CreationDisposition::CREATE, plan.size());
+  cleanup.created();
+  auto outView = outMap.getView(0, outMap.size());
+  plan.write(outView);
+  cleanup.commit();
+}
+
+// Deflates the input segments as one stream, so discontiguous buffers need not be gathered
+//   into one first. Runs and back references are found across segment boundaries and frames
+//   of options.blockSize may span segments, so the output is that of deflating the stream
+//   contiguously. Like deflateBatch(), input which does not compress is stored.
+std::vector<std::byte> deflateGather(std::span<const std::span<const std::byte>> inSegments, const DeflateOptions& options = {}) {
+  uint64_t length = segmentsLength(inSegments);
+  uint64_t blockSize = options.blockSize == 0 ? length : options.blockSize;
+
+  std::vector<std::vector<std::span<const std::byte>>> blocks;
+  for(uint64_t offset = 0; offset < length; offset += blockSize) {
+    blocks.push_back(sliceSegments(inSegments, offset, std::min(blockSize, length - offset)));
+  }
+
+  std::vector<RLETable> tables(blocks.size());
+  parallelFor(blocks.size(), [&](size_t b) {
+    options.cancellation.throwIfCancelled();
+    tables[b] = planFrame(blocks[b], tablePieces(segmentsLength(std::span<const std::span<const std::byte>>(blocks[b]))), options.format, options.level, options.maxWorkers(), options.cancellation);
+  }, options.maxWorkers());
+
+  if(options.level == CompressionLevel::MAX) {
+    std::vector<std::vector<SplitBlock>> refined(blocks.size());
+    parallelFor(blocks.size(), [&](size_t b) {
+      options.cancellation.throwIfCancelled();
+      splitWhileSmaller(blocks[b], std::move(tables[b]), options, refined[b]);
+    }, options.maxWorkers());
+
+    auto unsplit = std::move(blocks);
+    blocks.clear();
+    tables.clear();
+    for(size_t b = 0; b < unsplit.size(); b++) {
+      for(auto& split : refined[b]) {
+        blocks.push_back(sliceSegments(std::span<const std::span<const std::byte>>(unsplit[b]), split.offset, split.length));
+        tables.push_back(std::move(split.table));
+      }
+    }
+  }
+
+  std::vector<uint64_t> offsets{ 0 };
+  for(size_t b = 0; b < blocks.size(); b++) {
+    offsets.push_back(offsets.back() + frameLength(tables[b], segmentsLength(std::span<const std::span<const std::byte>>(blocks[b])), options.checksums));
+  }
+
+  std::vector<std::byte> deflated((size_t)offsets.back());
+  parallelFor(blocks.size(), [&](size_t b) {
+    options.cancellation.throwIfCancelled();
+    auto out = std::span(deflated).subspan((size_t)offsets[b], (size_t)(offsets[b + 1] - offsets[b]));
+    writeFrame(blocks[b], tables[b], out, options.checksums);
+  }, options.maxWorkers());
+  return deflated;
+}
+
+// Deflates data within its own buffer and returns the deflated image, which occupies the
+//   front of it. The literals of every frame are first compacted towards the front, which
+//   never overtakes the input still to be read. Frames are then moved out to their final
+//   places, last first, with their header and node table written in front of them. Beyond
+//   the buffer, only the node tables are held in memory, along with the literals of the
+//   frame being entropy coded, if it is.
+// Throws, leaving data untouched, if the image would not be smaller than data.
+std::span<std::byte> deflateInPlace(std::span<std::byte> data, const DeflateOptions& options = {}) {
+  auto plan = planDeflate(data, options);
+  if(!plan.compressible() || plan.size() >= data.size()) {
+    throw std::runtime_error("Cannot deflate this data efficiently.");
+  }
+
+  size_t frameCount = plan.blocks.size();
+  std::vector<Header> headers(frameCount);
+  std::vector<FrameChecksum> checksums(frameCount);
+  std::vector<uint64_t> literalOffsets{ 0 }; // one per frame once compacted, plus the total length
+  std::byte* outIter = data.data();
+  for(size_t i = 0; i < frameCount; i++) {
+    auto& table = plan.tables[i];
+    auto& header = headers[i];
+    header.setNodeFormat(table.format);
+    if(options.checksums) { header.setFlag(FrameFlag::CHECKSUM); }
+    header.setFlags(table.flags);
+    header.decompressedLength = plan.blocks[i].size();
+    header.tableNodeCount = table.nodeCount;
+
+    std::vector<std::byte> nodes(table.nodes.sizeBytes());
+    table.nodes.copyTo(nodes.data());
+
+    std::array<uint32_t, 2> crcs{ ~0u, ~0u }; // compressed, decompressed
+    if(options.checksums) {
+      crcs[0] = crc32cUpdate(crcs[0], std::as_bytes(std::span(&header, 1)));
+      crcs[0] = crc32cUpdate(crcs[0], nodes);
+    }
+    if(table.literalCode) {
+      uint32_t headCrc = crcs[0];
+      std::vector<std::byte> literals((size_t)table.literalCode->literalCount);
+      gatherLiteralsByFormat(table.format, nodes, table.nodeCount, table.flags, std::span(&plan.blocks[i], 1), literals.data(), options.checksums ? &crcs : nullptr);
+      std::span<std::byte> coded(outIter, (size_t)table.literalCode->size());
+      encodeLiterals(literals, *table.literalCode, coded);
+      crcs[0] = crc32cUpdate(headCrc, coded);
+      outIter += coded.size();
+    }
+    else {
+      outIter = gatherLiteralsByFormat(table.format, nodes, table.nodeCount, table.flags, std::span(&plan.blocks[i], 1), outIter, options.checksums ? &crcs : nullptr);
+    }
+    checksums[i] = { ~crcs[0], ~crcs[1] };
+    literalOffsets.push_back(outIter - data.data());
+  }
+
+  for(size_t i = frameCount; i-- > 0; ) {
+    auto frame = plan.frame(i, data);
+    auto& table = plan.tables[i];
+    size_t literalLength = (size_t)(literalOffsets[i + 1] - literalOffsets[i]);
+    std::byte* literals = frame.data() + sizeof(Header) + table.nodes.sizeBytes();
+    std::memmove(literals, data.data() + literalOffsets[i], literalLength);
+    std::memcpy(frame.data(), &headers[i], sizeof(Header));
+    table.nodes.copyTo(frame.data() + sizeof(Header));
+    if(options.checksums) {
+      std::memcpy(literals + literalLength, &checksums[i], sizeof(FrameChecksum));
+    }
+  }
+  return data.first((size_t)plan.size());
+}
+
+// Deflates data in place, shrinking it to the deflated image.
+void deflateInPlace(std::vector<std::byte>& data, const DeflateOptions& options = {}) {
+  data.resize(deflateInPlace(std::span(data), options).size());
+}
+
+// Deflates many inputs at once, all sharing the worker pool. Unlike deflateFile(), an input
+//   which does not compress is stored rather than rejected, so one input cannot fail the
+//   whole batch.
+std::vector<std::vector<std::byte>> deflateBatch(std::span<const std::span<const std::byte>> inputs, const DeflateOptions& options = {}) {
+  auto plans = planDeflateBatch(inputs, options);
+  std::vector<std::vector<std::byte>> deflated(plans.size());
+  std::vector<std::span<std::byte>> outs(plans.size());
+  for(size_t i = 0; i < plans.size(); i++) {
+    deflated[i].resize((size_t)plans[i].size());
+    outs[i] = deflated[i];
+  }
+  writeBatch(plans, outs);
+  return deflated;
+}
+
+// File form of deflateBatch(). Jobs are mapped and deflated a batch at a time, so the number
+//   of files open at once stays bounded. Under options.maxMemory, files are instead deflated
+//   one at a time, each within the budget.
+void deflateBatch(const std::vector<BatchJob>& jobs, const DeflateOptions& options = {}) {
+  constexpr size_t BATCH_SIZE = 1024;
+
+  if(options.maxMemory != 0) {
+    for(auto& job : jobs) {
+      MappedFile inMap(job.inputFilename, MappedFile::CreationDisposition::OPEN);
+      if(inMap.size() == 0) {
+        MappedFile empty(job.outputFilename, MappedFile::CreationDisposition::CREATE);
+        continue;
+      }
+      OutputCleanup cleanup(job.outputFilename);
+      deflateWithinBudget(inMap, job.outputFilename, cleanup, options);
+      cleanup.commit();
+    }
+    return;
+  }
+
+  for(size_t first = 0; first < jobs.size(); first += BATCH_SIZE) {
+    size_t count = std::min(BATCH_SIZE, jobs.size() - first);
+    std::span<const BatchJob> batch(jobs.data() + first, count);
+
+    MappedInputs inputs(jobInputs(batch));
+    auto plans = planDeflateBatch(inputs.spans, options);
+
+    std::vector<uint64_t> lengths;
+    for(auto& plan : plans) {
+      lengths.push_back(plan.size());
+    }
+    MappedOutputs outputs(batch, lengths);
+    writeBatch(plans, outputs.spans);
+    outputs.commit();
+  }
+}
@@ -0,0 +1,723 @@
+#pragma once
+#include "RLE_Inflate.h"
+#include "RLE_Deflate.h"
+#include "RLE_Verify.h"
+#include <optional>
+
+// Compressed-domain editing of RLE files. These operations work on node tables and literal
+//   sections directly and never inflate the data they carry.
+
+// class FrameBuilder
+// Assembles a frame from a stream of literal spans, runs and back references, as produced by
+//   walkFrame(), so compressed data can be re-framed without being inflated. Literal spans
+//   are referenced, not copied, until build() is called, so they must outlive the builder,
+//   unless they are added with copyLiterals().
+class FrameBuilder {
+public:
+  void addLiterals(std::span<const std::byte> literals) {
+    if(literals.empty()) { return; }
+    segments.push_back({ literals, std::byte{}, 0 });
+    length += literals.size();
+  }
+
+  // For literals which do not live as long as the builder, such as expanded back references.
+  void copyLiterals(std::span<const std::byte> literals) {
+    if(literals.empty()) { return; }
+    addLiterals(copies.emplace_back(literals.begin(), literals.end()));
+  }
+
+  // Adjacent runs of the same value are merged.
+  void addRun(std::byte value, uint64_t runLength) {
+    if(runLength == 0) { return; }
+    if(!segments.empty() && segments.back().literals.empty() && segments.back().distance == 0 && segments.back().value == value) {
+      segments.back().runLength += runLength;
+    }
+    else {
+      segments.push_back({ {}, value, runLength });
+    }
+    length += runLength;
+  }
+
+  // Adds a back reference to content already added. Adjacent references of the same
+  //   distance are merged, as they repeat one pattern.
+  void addMatch(uint64_t distance, uint64_t matchLength) {
+    if(matchLength == 0) { return; }
+    if(distance == 0 || distance > MATCH_WINDOW || distance > length) {
+      throw std::logic_error("Back reference reaches before the frame.");
+    }
+    if(!segments.empty() && segments.back().literals.empty() && segments.back().distance == distance) {
+      segments.back().runLength += matchLength;
+    }
+    else {
+      segments.push_back({ {}, std::byte{}, matchLength, (uint32_t)distance });
+    }
+    length += matchLength;
+    matches = true;
+  }
+
+  uint64_t decompressedLength() const { return length; }
+
+  // Returns the most efficient node format for the content added so far. Content without
+  //   worthwhile runs gets P8L8, which will simply produce an empty table.
+  NodeFormat bestFormat() const {
+    std::vector<Run> runs;
+    uint64_t prefix = 0;
+    for(auto& segment : segments) {
+      if(segment.runLength > (segment.distance != 0 ? 2 : 1) * sizeof(Node8x8)) {
+        runs.push_back({ prefix, segment.runLength, segment.value, segment.distance });
+        prefix = 0;
+      }
+      else {
+        prefix += segment.literals.size() + segment.runLength;
+      }
+    }
+
+    auto format = selectFormat(runs).first;
+    return format == NodeFormat::INEFFICIENT ? NodeFormat::P8L8 : format;
+  }
+
+  // Builds the frame in format. Back references are kept wherever they stay within their
+  //   restart intervals in the new frame, and are expanded into literals elsewhere. flags are
+  //   the FrameFlag bits of the frames the content came from: given REPEATS, recurring groups
+  //   of runs are encoded as repeat nodes, and given CODED_LITERALS, the literal section is
+  //   entropy coded where that saves enough, as deflate does from STRONG on.
+  std::vector<std::byte> build(NodeFormat format, bool checksum, uint8_t flags = 0) const {
+    switch(format) {
+    case NodeFormat::P8L8:   return buildAs<Node8x8  >(format, checksum, flags);
+    case NodeFormat::P8L16:  return buildAs<Node8x16 >(format, checksum, flags);
+    case NodeFormat::P16L8:  return buildAs<Node16x8 >(format, checksum, flags);
+    case NodeFormat::P16L16: return buildAs<Node16x16>(format, checksum, flags);
+    default: throw std::logic_error("Failed switch to format.");
+    }
+  }
+
+private:
+  template <class NodeType>
+  std::vector<std::byte> buildAs(NodeFormat format, bool checksum, uint8_t flags) const {
+    constexpr size_t MATCH_CHUNK = 1 << 12;
+
+    std::vector<Run> runs;
+    std::vector<std::byte> literals;
+    uint32_t decompressedCrc = ~0u;
+    uint64_t prefix = 0;
+    uint64_t position = 0;
+    MatchWindow window; // kept only when there are back references to expand
+    for(auto& segment : segments) {
+      if(!segment.literals.empty()) {
+        literals.insert(literals.end(), segment.literals.begin(), segment.literals.end());
+        prefix += segment.literals.size();
+        if(checksum) { decompressedCrc = crc32cUpdate(decompressedCrc, segment.literals); }
+        if(matches) { window.append(segment.literals); }
+        position += segment.literals.size();
+        continue;
+      }
+
+      if(segment.distance != 0) {
+        // A reference is expanded for its checksum and for the window, and whatever of it is
+        //   not encoded is left in the literals.
+        uint64_t tail = matchWithinRestart(position, segment.runLength, segment.distance) ? unencodableMatchTail<NodeType>(segment.runLength) : segment.runLength;
+        if(segment.runLength > tail) {
+          runs.push_back({ prefix, segment.runLength - tail, std::byte{}, segment.distance });
+          prefix = 0;
+        }
+        std::array<std::byte, MATCH_CHUNK> chunk;
+        for(uint64_t done = 0; done < segment.runLength; ) {
+          auto piece = std::span(chunk).first((size_t)std::min<uint64_t>(segment.runLength - done, chunk.size()));
+          fillPattern(piece, window.last(segment.distance), 0);
+          window.append(piece);
+          if(checksum) { decompressedCrc = crc32cUpdate(decompressedCrc, piece); }
+          uint64_t literalStart = std::max(done, segment.runLength - tail);
+          if(literalStart < done + piece.size()) {
+            auto left = piece.subspan((size_t)(literalStart - done));
+            literals.insert(literals.end(), left.begin(), left.end());
+          }
+          done += piece.size();
+        }
+        prefix += tail;
+        position += segment.runLength;
+        continue;
+      }
+
+      uint64_t tail = unencodableTail<NodeType>(segment.runLength);
+      if(segment.runLength > tail) {
+        runs.push_back({ prefix, segment.runLength - tail, segment.value });
+        prefix = 0;
+      }
+      literals.insert(literals.end(), (size_t)tail, segment.value);
+      prefix += tail;
+      if(checksum) { decompressedCrc = crc32cUpdate(decompressedCrc, segment.value, segment.runLength); }
+      if(matches) { window.append(segment.value, segment.runLength); }
+      position += segment.runLength;
+    }
+
+    ArenaVector<NodeType> nodes;
+    uint8_t nodeFlags = 0;
+    if(flags & (uint8_t)FrameFlag::REPEATS) {
+      if(parseRunsRepeating(runs, 0, runs.size(), nodes)) { nodeFlags |= (uint8_t)FrameFlag::REPEATS; }
+    }
+    else {
+      for(auto& run : runs) {
+        parseRun(run, nodes);
+      }
+    }
+    if(std::any_of(runs.begin(), runs.end(), [](const Run& run) { return run.distance != 0; })) {
+      nodeFlags |= (uint8_t)FrameFlag::MATCHES;
+    }
+    if(nodes.size() > std::numeric_limits<uint32_t>::max()) {
+      throw std::runtime_error("RLE table too large.");
+    }
+
+    if((flags & (uint8_t)FrameFlag::CODED_LITERALS) && !literals.empty()) {
+      std::array<LiteralHistogram, LITERAL_STREAMS> histograms{};
+      uint64_t share = literalStreamShare(literals.size());
+      for(size_t i = 0; i < literals.size(); i++) {
+        histograms[(size_t)(i / share)][(uint8_t)literals[i]]++;
+      }
+      if(auto code = planLiteralCode(histograms)) {
+        std::vector<std::byte> section((size_t)code->size());
+        encodeLiterals(literals, *code, section);
+        literals = std::move(section);
+        nodeFlags |= (uint8_t)FrameFlag::CODED_LITERALS;
+      }
+    }
+
+    std::vector<std::byte> frame(sizeof(Header) + nodes.sizeBytes());
+    Header* header = new(frame.data()) Header;
+    header->setNodeFormat(format);
+    if(checksum) { header->setFlag(FrameFlag::CHECKSUM); }
+    header->setFlags(nodeFlags);
+    header->decompressedLength = length;
+    header->tableNodeCount = (uint32_t)nodes.size();
+    nodes.copyTo(frame.data() + sizeof(Header));
+    frame.insert(frame.end(), literals.begin(), literals.end());
+
+    if(checksum) {
+      FrameChecksum record{ crc32c(frame), ~decompressedCrc };
+      auto recordBytes = std::as_bytes(std::span(&record, 1));
+      frame.insert(frame.end(), recordBytes.begin(), recordBytes.end());
+    }
+    return frame;
+  }
+
+  struct Segment {
+    std::span<const std::byte> literals; // empty for a run or back reference
+    std::byte value;
+    uint64_t runLength;
+    uint32_t distance = 0; // for a back reference
+  };
+
+  std::vector<Segment> segments;
+  std::deque<std::vector<std::byte>> copies; // literals added by copyLiterals()
+  uint64_t length = 0;
+  bool matches = false; // whether any back reference was added
+
+};
+
+// Writes pieces, which are complete frames, back to back into a new file.
+void writeFrames(const std::string& outputFilename, const std::vector<std::span<const std::byte>>& pieces) {
+  uint64_t totalLength = 0;
+  for(auto& piece : pieces) {
+    totalLength += piece.size();
+  }
+
+  MappedFile outMap(outputFilename, MappedFile::CreationDisposition::CREATE, totalLength);
+  auto outView = outMap.getView(0, outMap.size());
+  auto outIter = outView.begin();
+  for(auto& piece : pieces) {
+    outIter = std::copy(piece.begin(), piece.end(), outIter);
+  }
+}
+
+// Adds literals which walkFrame() passed from frame to builder. Those lying in the literal
+//   section are referenced, and those expanded from back references copied.
+void addWalkedLiterals(FrameBuilder& builder, const RLEFrame& frame, std::span<const std::byte> literals) {
+  auto section = frame.literals;
+  if(literals.data() >= section.data() && literals.data() < section.data() + section.size()) {
+    builder.addLiterals(literals);
+  }
+  else {
+    builder.copyLiterals(literals);
+  }
+}
+
+// Appends the entire content of frame to builder, back references included. An entropy coded
+//   section must have been decoded into frame with decodeFrameLiterals(), as its literals
+//   are referenced.
+void addFrame(FrameBuilder& builder, const RLEFrame& frame) {
+  if(!frame.codedLiterals.empty() && !frame.decodedLiterals) {
+    throw std::logic_error("Frame literals have not been decoded.");
+  }
+  auto literals = frame.literals;
+  for(auto& run : frame.runs) {
+    builder.addLiterals(literals.first((size_t)run.prefix));
+    literals = literals.subspan((size_t)run.prefix);
+    if(run.distance != 0) {
+      builder.addMatch(run.distance, run.length);
+    }
+    else {
+      builder.addRun(run.value, run.length);
+    }
+  }
+  builder.addLiterals(literals);
+}
+
+// Re-frames [begin, end) of frame in its own format, keeping its checksum setting and its
+//   encodings. Back references copying from before begin are expanded. Literals are only
+//   referenced if an entropy coded section was decoded into frame beforehand.
+std::vector<std::byte> trimFrame(const RLEFrame& frame, uint64_t begin, uint64_t end) {
+  FrameBuilder builder;
+  walkFrame(frame, FrameIndex(frame), begin, end,
+    [&](std::span<const std::byte> literals) { addWalkedLiterals(builder, frame, literals); },
+    [&](std::byte value, uint64_t length) { builder.addRun(value, length); },
+    [&](uint64_t distance, uint64_t length) { builder.addMatch(distance, length); return true; });
+  return builder.build(frame.format, frame.checksum != nullptr, frame.header->flags());
+}
+
+// Extracts [offset, offset + length) of the decompressed content of an RLE file into a new
+//   RLE file. Frames lying wholly inside the range are copied through untouched. The frames
+//   at either edge are trimmed: their literals are copied through and their runs re-encoded
+//   from the covering nodes, so the cost follows the compressed size of the slice.
+void sliceFile(const std::string& inputFilename, const std::string& outputFilename, uint64_t offset, uint64_t length) {
+  MappedFile inMap(inputFilename, MappedFile::CreationDisposition::OPEN);
+  auto inView = inMap.getView(0, inMap.size());
+  auto frames = readFrames(inView);
+
+  uint64_t decompressedLength = totalDecompressedLength(frames);
+  if(length == 0 || offset > decompressedLength || length > decompressedLength - offset) {
+    throw std::runtime_error("Slice range lies outside the decompressed data.");
+  }
+
+  std::vector<std::vector<std::byte>> trimmed;
+  std::vector<std::span<const std::byte>> pieces;
+  trimmed.reserve(2);
+
+  uint64_t end = offset + length;
+  uint64_t frameOffset = 0;
+  for(auto& frame : frames) {
+    uint64_t frameEnd = frameOffset + frame.decompressedLength();
+    uint64_t begin = std::max(offset, frameOffset);
+    uint64_t stop = std::min(end, frameEnd);
+    if(begin < stop) {
+      if(begin == frameOffset && stop == frameEnd) {
+        pieces.push_back(frame.bytes);
+      }
+      else {
+        if(!frame.codedLiterals.empty()) { decodeFrameLiterals(frame); }
+        trimmed.push_back(trimFrame(frame, begin - frameOffset, stop - frameOffset));
+        pieces.push_back(trimmed.back());
+      }
+    }
+    frameOffset = frameEnd;
+  }
+
+  writeFrames(outputFilename, pieces);
+}
+
+// Stitches frame a and the frame b that follows it into a single frame: a run ending a merges
+//   with a run of the same value starting b, and trailing literals of a become the prefix of
+//   the first run of b. The frame keeps the common node format of a and b, or is re-encoded
+//   in the best format for its content if they differ. It carries a checksum if either did,
+//   and keeps the encodings of both.
+std::vector<std::byte> stitchFrames(const RLEFrame& a, const RLEFrame& b) {
+  FrameBuilder builder;
+  addFrame(builder, a);
+  addFrame(builder, b);
+  auto format = a.format == b.format ? a.format : builder.bestFormat();
+  return builder.build(format, a.checksum != nullptr || b.checksum != nullptr, a.header->flags() | b.header->flags());
+}
+
+// Every node of a table encodes at least one byte, so frames which together inflate to no
+//   more than this always stitch into a table whose node count fits in its header.
+constexpr uint64_t STITCH_MAX_LENGTH = std::numeric_limits<uint32_t>::max();
+
+// An input of concatFiles(), mapped with its frames read.
+struct ConcatInput {
+  explicit ConcatInput(const std::string& filename) :
+    map(filename, MappedFile::CreationDisposition::OPEN),
+    view(map.getView(0, map.size())),
+    frames(readFrames(view))
+  {}
+
+  MappedFile map;
+  MappedFile::View view;
+  std::vector<RLEFrame> frames;
+};
+
+// Concatenates the decompressed content of several RLE files into a new RLE file, without
+//   inflating any of them. Inputs are read one after another and their frames written out
+//   as they go, so only two inputs are mapped at once and memory does not grow with the
+//   number of inputs. Frames away from a file boundary are copied through untouched.
+// At each boundary the last frame of one file and the first frame of the next are stitched
+//   by stitchFrames(). A frame joins at most one seam, so a single frame file stitched to
+//   the file before it is copied through at its boundary with the file after. Frames which
+//   together inflate to more than STITCH_MAX_LENGTH are left unstitched. Should an input
+//   fail to read, the output written so far is removed.
+void concatFiles(const std::vector<std::string>& inputFilenames, const std::string& outputFilename) {
+  if(inputFilenames.empty()) {
+    throw std::runtime_error("Nothing to concatenate.");
+  }
+
+  uint64_t outLength = 0;
+  OutputCleanup cleanup(outputFilename);
+  auto writePieces = [&](const std::vector<std::span<const std::byte>>& pieces) {
+    uint64_t length = 0;
+    for(auto& piece : pieces) {
+      length += piece.size();
+    }
+    if(length == 0) { return; }
+
+    auto disposition = outLength == 0 ? MappedFile::CreationDisposition::CREATE : MappedFile::CreationDisposition::OPEN;
+    MappedFile outMap(outputFilename, disposition, outLength + length);
+    cleanup.created();
+    auto outView = outMap.getView(outLength, (size_t)length);
+    auto outIter = outView.begin();
+    for(auto& piece : pieces) {
+      outIter = std::copy(piece.begin(), piece.end(), outIter);
+    }
+    outLength += length;
+  };
+
+  // The previous input stays mapped while its last frame is held back for the next seam.
+  std::unique_ptr<ConcatInput> previous;
+  bool holding = false;
+  for(size_t f = 0; f < inputFilenames.size(); f++) {
+    auto current = std::make_unique<ConcatInput>(inputFilenames[f]);
+    auto& frames = current->frames;
+
+    std::vector<std::byte> stitched;
+    std::vector<std::span<const std::byte>> pieces;
+    size_t first = 0;
+    if(holding) {
+      auto& held = previous->frames.back();
+      if(!frames.empty() && held.decompressedLength() + frames[0].decompressedLength() <= STITCH_MAX_LENGTH) {
+        for(auto frame : { &held, &frames[0] }) {
+          if(!frame->codedLiterals.empty()) { decodeFrameLiterals(*frame); }
+        }
+        stitched = stitchFrames(held, frames[0]);
+        pieces.push_back(stitched);
+        first = 1;
+      }
+      else {
+        pieces.push_back(held.bytes);
+      }
+    }
+
+    // The last frame is held back if it is free to join the next input's first.
+    bool hold = f + 1 < inputFilenames.size() && frames.size() > first;
+    for(size_t i = first; i < frames.size() - (hold ? 1 : 0); i++) {
+      pieces.push_back(frames[i].bytes);
+    }
+    writePieces(pieces);
+
+    previous = std::move(current);
+    holding = hold;
+  }
+
+  // Empty inputs concatenate to an empty output, which nothing above has created.
+  if(outLength == 0) {
+    MappedFile empty(outputFilename, MappedFile::CreationDisposition::CREATE);
+    cleanup.created();
+  }
+  cleanup.commit();
+}
+
+// Re-encodes the node table of frame in format, keeping its literal section exactly as
+//   stored, entropy coded or not, and its decompressed checksum. Returns nullopt if a run
+//   would leave a tail in format too short for a node, which would change the literals.
+template <class NodeType>
+std::optional<std::vector<std::byte>> retableFrameAs(const RLEFrame& frame, NodeFormat format) {
+  for(auto& run : frame.runs) {
+    uint64_t tail = run.distance != 0 ? unencodableMatchTail<NodeType>(run.length) : unencodableTail<NodeType>(run.length);
+    if(tail != 0) { return std::nullopt; }
+  }
+
+  ArenaVector<NodeType> nodes;
+  uint8_t flags = frame.header->flags() & (uint8_t)~(uint8_t)FrameFlag::REPEATS;
+  if(frame.header->hasFlag(FrameFlag::REPEATS)) {
+    if(parseRunsRepeating(frame.runs, 0, frame.runs.size(), nodes)) { flags |= (uint8_t)FrameFlag::REPEATS; }
+  }
+  else {
+    for(auto& run : frame.runs) {
+      parseRun(run, nodes);
+    }
+  }
+  if(nodes.size() > std::numeric_limits<uint32_t>::max()) {
+    throw std::runtime_error("RLE table too large.");
+  }
+
+  auto section = frame.header->hasFlag(FrameFlag::CODED_LITERALS) ? frame.codedLiterals : frame.literals;
+  std::vector<std::byte> out(sizeof(Header) + nodes.sizeBytes());
+  Header* header = new(out.data()) Header;
+  header->setNodeFormat(format);
+  header->setFlags(flags);
+  header->decompressedLength = frame.decompressedLength();
+  header->tableNodeCount = (uint32_t)nodes.size();
+  nodes.copyTo(out.data() + sizeof(Header));
+  out.insert(out.end(), section.begin(), section.end());
+
+  if(frame.checksum) {
+    FrameChecksum record{ crc32c(out), frame.checksum->decompressed };
+    auto recordBytes = std::as_bytes(std::span(&record, 1));
+    out.insert(out.end(), recordBytes.begin(), recordBytes.end());
+  }
+  return out;
+}
+
+std::optional<std::vector<std::byte>> retableFrame(const RLEFrame& frame, NodeFormat format) {
+  switch(format) {
+  case NodeFormat::P8L8:   return retableFrameAs<Node8x8  >(frame, format);
+  case NodeFormat::P8L16:  return retableFrameAs<Node8x16 >(frame, format);
+  case NodeFormat::P16L8:  return retableFrameAs<Node16x8 >(frame, format);
+  case NodeFormat::P16L16: return retableFrameAs<Node16x16>(frame, format);
+  default: throw std::logic_error("Failed switch to format.");
+  }
+}
+
+// Re-encodes the node tables of an RLE file in another node format, without inflating it.
+// Each frame's table is decoded to runs and re-parsed for the target format. Where every run
+//   encodes exactly in the target format, the literal section is copied across as stored,
+//   entropy coded or not. Otherwise the frame is rebuilt, and run tails too short to be worth
+//   a node in the target format join its literals, which are coded again if they were
+//   before. Frames are transcoded in parallel, and frames already in the target format are
+//   copied through. With no target, each frame is re-encoded in the best format for its own
+//   runs.
+void transcodeFile(const std::string& inputFilename, const std::string& outputFilename, std::optional<NodeFormat> target) {
+  if(target && *target == NodeFormat::INEFFICIENT) {
+    throw std::runtime_error("Cannot transcode to an inefficient node format.");
+  }
+
+  MappedFile inMap(inputFilename, MappedFile::CreationDisposition::OPEN);
+  auto inView = inMap.getView(0, inMap.size());
+  auto frames = readFrames(inView);
+
+  std::vector<std::vector<std::byte>> transcoded(frames.size());
+  std::vector<std::span<const std::byte>> pieces(frames.size());
+  parallelFor(frames.size(), [&](size_t i) {
+    auto& frame = frames[i];
+    auto format = target ? *target : selectFormat(frame.runs).first;
+    if(format == NodeFormat::INEFFICIENT) { format = NodeFormat::P8L8; }
+    if(format == frame.format) {
+      pieces[i] = frame.bytes;
+      return;
+    }
+
+    if(auto retabled = retableFrame(frame, format)) {
+      transcoded[i] = std::move(*retabled);
+    }
+    else {
+      if(!frame.codedLiterals.empty()) { decodeFrameLiterals(frame); }
+      FrameBuilder builder;
+      addFrame(builder, frame);
+      transcoded[i] = builder.build(format, frame.checksum != nullptr, frame.header->flags());
+    }
+    pieces[i] = transcoded[i];
+  });
+
+  writeFrames(outputFilename, pieces);
+}
+
+// Lengthens the run encoded by the last node of a table by up to extra bytes, in place.
+// Only the last standard or long node is touched, so the table keeps its size.
+// Returns how many bytes the node absorbed, which is limited by the room left in its fields.
+template <class NodeType>
+uint64_t extendLastRun(std::span<std::byte> table, uint64_t extra) {
+  std::span<NodeType> nodes(reinterpret_cast<NodeType*>(table.data()), table.size() / sizeof(NodeType));
+
+  // The table has to be walked forwards to tell long nodes from the nodes around them.
+  NodeType* last = nullptr;
+  bool lastIsLong = false;
+  for(size_t i = 0; i < nodes.size(); i++) {
+    lastIsLong = nodes[i].length == 0 && nodes[i].value == (std::byte)0;
+    if(lastIsLong) { i++; }
+    last = i < nodes.size() ? &nodes[i] : nullptr;
+  }
+  if(!last) { return 0; }
+
+  if(lastIsLong) {
+    constexpr uint64_t maxLongLength = NodeType::LengthMax | ((uint64_t)NodeType::PrefixMax << bitsizeof<typename NodeType::LengthType>());
+    uint64_t length = last->getLongLength();
+    uint64_t absorbed = std::min(extra, maxLongLength - length);
+    last->beLongNode(length + absorbed, last->value);
+    return absorbed;
+  }
+
+  if(last->length == 0) { return 0; } //skip node
+  uint64_t absorbed = std::min<uint64_t>(extra, NodeType::LengthMax - last->length);
+  last->length = (typename NodeType::LengthType)(last->length + absorbed);
+  return absorbed;
+}
+
+// Extends the content of an existing RLE file with data, touching only the end of the file.
+// If the file ends in a run which data continues, the last node is lengthened in place as far
+//   as its fields allow, and its frame checksum patched. That is skipped where the last
+//   frame holds repeat nodes or back references, since its last node may then not be a
+//   plain run. Whatever remains of data is deflated into new frames after the existing ones,
+//   which are never rebuilt.
+// The cost is that of deflating data, plus a scan of the node tables to locate the last
+//   frame, of which only the last is read into runs. Existing literals are never read or
+//   moved, and coded sections are not decoded.
+void appendFile(const std::string& rleFilename, std::span<const std::byte> data, const DeflateOptions& options = {}) {
+  if(data.empty()) { return; }
+
+  uint64_t keptLength = 0; // bytes of the existing file, which stay where they are
+  {
+    MappedFile rleMap(rleFilename, MappedFile::CreationDisposition::OPEN);
+    auto rleView = rleMap.getView(0, rleMap.size());
+    if(rleView.empty()) {
+      throw std::runtime_error("Cannot append to an empty RLE file.");
+    }
+    uint64_t lastOffset = 0;
+    for(uint64_t offset = 0; offset < rleView.size(); offset += frameByteLength(rleView.subspan((size_t)offset))) {
+      lastOffset = offset;
+    }
+    auto last = readFrame(rleView.subspan((size_t)lastOffset));
+    keptLength = rleView.size();
+
+    uint64_t trailingLiterals = last.literalCount;
+    for(auto& run : last.runs) {
+      trailingLiterals -= run.prefix;
+    }
+    bool extensible = !last.header->hasFlag(FrameFlag::REPEATS) && !last.header->hasFlag(FrameFlag::MATCHES); // the last node may not be a plain run
+    if(extensible && trailingLiterals == 0 && !last.runs.empty() && last.runs.back().value == data[0]) {
+      auto value = data[0];
+      uint64_t leading = findMismatch(data, value);
+      std::span<std::byte> frame(rleView.data() + lastOffset, last.bytes.size());
+      std::span<std::byte> table = frame.subspan(sizeof(Header), last.head.size() - sizeof(Header));
+      Header* header = reinterpret_cast<Header*>(frame.data());
+      std::vector<std::byte> before(frame.begin(), frame.begin() + last.head.size());
+
+      uint64_t absorbed = 0;
+      switch(last.format) {
+      case NodeFormat::P8L8:   absorbed = extendLastRun<Node8x8  >(table, leading); break;
+      case NodeFormat::P8L16:  absorbed = extendLastRun<Node8x16 >(table, leading); break;
+      case NodeFormat::P16L8:  absorbed = extendLastRun<Node16x8 >(table, leading); break;
+      case NodeFormat::P16L16: absorbed = extendLastRun<Node16x16>(table, leading); break;
+      default: throw std::logic_error("Failed switch to format.");
+      }
+      header->decompressedLength += absorbed;
+
+      if(last.checksum && absorbed) {
+        auto checksum = reinterpret_cast<FrameChecksum*>(frame.data() + frame.size() - sizeof(FrameChecksum));
+        uint64_t checkedLength = frame.size() - sizeof(FrameChecksum);
+        checksum->compressed = crc32cPatch(checksum->compressed, checkedLength, 0, before, frame.first(before.size()));
+        checksum->decompressed = ~crc32cUpdate(~checksum->decompressed, value, absorbed);
+      }
+      data = data.subspan((size_t)absorbed);
+    }
+  }
+
+  // Plan the frames for the remaining data, then grow the file to hold them.
+  auto plan = planDeflate(data, options);
+  uint64_t newLength = keptLength + plan.size();
+  if(newLength == keptLength) { return; }
+
+  MappedFile rleMap(rleFilename, MappedFile::CreationDisposition::OPEN, newLength);
+  auto outView = rleMap.getView(keptLength, (size_t)plan.size());
+  plan.write(outView);
+}
+
+void appendFile(const std::string& rleFilename, const std::string& dataFilename, const DeflateOptions& options = {}) {
+  MappedFile dataMap(dataFilename, MappedFile::CreationDisposition::OPEN);
+  auto dataView = dataMap.getView(0, dataMap.size());
+  appendFile(rleFilename, dataView, options);
+}
+
+struct ByteRange {
+  uint64_t offset;
+  uint64_t length;
+};
+
+// Writes an RLE file for the content of newFilename, reusing frames of the existing RLE file
+//   wherever the content is unchanged. dirtyRanges lists the decompressed byte ranges which
+//   may differ between the two. Frames overlapping a dirty range, or reaching past the end
+//   of the new content, are deflated again from the new file over the same block boundaries.
+// All other frames are copied through with their tables and literals as they are, so files
+//   deflated with DeflateOptions::blockSize only pay for the blocks which changed. Content
+//   past the end of the existing file is deflated into new frames of options.blockSize.
+//   Frames deflated again take options.format and options.level, except that MAX does not
+//   split them, as their boundaries are kept.
+void updateFile(const std::string& rleFilename, const std::string& newFilename, std::vector<ByteRange> dirtyRanges, const std::string& outputFilename, const DeflateOptions& options = {}) {
+  MappedFile rleMap(rleFilename, MappedFile::CreationDisposition::OPEN);
+  MappedFile newMap(newFilename, MappedFile::CreationDisposition::OPEN);
+  auto rleView = rleMap.getView(0, rleMap.size());
+  auto newView = newMap.getView(0, newMap.size());
+  std::span<const std::byte> newData = newView;
+  auto frames = readFrames(rleView);
+
+  std::sort(dirtyRanges.begin(), dirtyRanges.end(), [](const ByteRange& a, const ByteRange& b) { return a.offset < b.offset; });
+
+  // Each piece of the output is either a reused frame or a block of the new file to deflate.
+  struct Piece {
+    std::span<const std::byte> reused;
+    std::span<const std::byte> block;
+    bool checksum = false;
+    RLETable table;
+    uint64_t length = 0;
+  };
+  std::vector<Piece> pieces;
+
+  uint64_t frameOffset = 0;
+  auto range = dirtyRanges.begin();
+  for(auto& frame : frames) {
+    uint64_t frameEnd = frameOffset + frame.decompressedLength();
+    if(frameOffset >= newData.size()) { break; }
+
+    while(range != dirtyRanges.end() && range->offset + range->length <= frameOffset) { range++; }
+    bool dirty = false;
+    for(auto iter = range; iter != dirtyRanges.end() && iter->offset < frameEnd; iter++) {
+      dirty |= iter->length != 0;
+    }
+
+    Piece piece;
+    if(!dirty && frameEnd <= newData.size()) {
+      piece.reused = frame.bytes;
+    }
+    else {
+      uint64_t blockEnd = std::min<uint64_t>(frameEnd, newData.size());
+      piece.block = newData.subspan((size_t)frameOffset, (size_t)(blockEnd - frameOffset));
+      piece.checksum = frame.checksum != nullptr;
+    }
+    pieces.push_back(std::move(piece));
+    frameOffset = frameEnd;
+  }
+
+  if(frameOffset < newData.size()) {
+    for(auto& block : splitBlocks(newData.subspan((size_t)frameOffset), options.blockSize)) {
+      Piece piece;
+      piece.block = block;
+      piece.checksum = options.checksums;
+      pieces.push_back(std::move(piece));
+    }
+  }
+
+  parallelFor(pieces.size(), [&](size_t i) {
+    auto& piece = pieces[i];
+    if(piece.block.empty()) {
+      piece.length = piece.reused.size();
+      return;
+    }
+    piece.table = planFrame(piece.block, tablePieces(piece.block.size()), options.format, options.level, 1, options.cancellation);
+    piece.length = frameLength(piece.table, piece.block.size(), piece.checksum);
+  });
+
+  std::vector<uint64_t> offsets{ 0 };
+  for(auto& piece : pieces) {
+    offsets.push_back(offsets.back() + piece.length);
+  }
+
+  OutputCleanup cleanup(outputFilename);
+  MappedFile outMap(outputFilename, MappedFile::CreationDisposition::CREATE, offsets.back());
+  cleanup.created();
+  auto outView = outMap.getView(0, outMap.size());
+  parallelFor(pieces.size(), [&](size_t i) {
+    auto& piece = pieces[i];
+    auto out = std::span(outView).subspan((size_t)offsets[i], (size_t)piece.length);
+    if(piece.block.empty()) {
+      std::copy(piece.reused.begin(), piece.reused.end(), out.begin());
+    }
+    else {
+      writeFrame(piece.block, piece.table, out, piece.checksum);
+    }
+  });
+  cleanup.commit();
+}
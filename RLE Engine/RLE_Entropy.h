@@ -0,0 +1,401 @@
+#pragma once
+#include "RLE_Shared.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <optional>
+#include <vector>
+
+// Entropy coding of literal sections. Once runs and back references are taken out, what is
+//   left of text-like data is a skewed distribution of byte values, which a Huffman code
+//   stores in well under eight bits per byte.
+// The literals of a frame are split into LITERAL_STREAMS equal quarters, each coded as its own
+//   bit stream under one shared code. Codes are limited to LITERAL_CODE_BITS, so one table
+//   lookup decodes any symbol, or two whose codes fit in it together, and the streams are
+//   decoded in lockstep so that their lookups overlap rather than each waiting on the last.
+
+constexpr size_t LITERAL_STREAMS = 4;
+constexpr unsigned LITERAL_CODE_BITS = 11;
+
+// Coding is skipped unless it saves at least this share of the literals, since decoding
+//   them is slower than copying them.
+constexpr uint64_t LITERAL_CODE_MIN_GAIN_PER_MILLE = 50;
+
+using LiteralHistogram = std::array<uint64_t, 256>;
+
+// A coded literal section is this header followed by each stream in order. Streams are
+//   written least significant bit first and padded to a whole byte.
+#pragma pack(push, 1)
+struct LiteralCodeHeader {
+  uint8_t codeLengths[128];                 // two 4 bit code lengths per byte, low nibble first, zero for absent symbols
+  uint64_t streamLengths[LITERAL_STREAMS];  // bytes of each stream
+};
+#pragma pack(pop)
+
+// Literals coded by each stream. The last stream takes whatever the others leave.
+uint64_t literalStreamShare(uint64_t literalCount) {
+  return (literalCount + LITERAL_STREAMS - 1) / LITERAL_STREAMS;
+}
+
+// struct LiteralCode
+// A code planned for a literal section, with the exact length each stream will code to.
+struct LiteralCode {
+  std::array<uint8_t, 256> lengths{};
+  std::array<uint64_t, LITERAL_STREAMS> streamLengths{};
+  uint64_t literalCount = 0;
+
+  // Bytes of the coded section.
+  uint64_t size() const {
+    uint64_t total = sizeof(LiteralCodeHeader);
+    for(auto length : streamLengths) {
+      total += length;
+    }
+    return total;
+  }
+};
+
+// Returns the code length of every symbol of a Huffman code for counts, no longer than
+//   LITERAL_CODE_BITS. Where the optimal code runs longer, the counts are flattened and the
+//   code built again. Symbols which never occur get no code, and a sole symbol gets one bit.
+std::array<uint8_t, 256> buildCodeLengths(LiteralHistogram counts) {
+  constexpr uint32_t SYMBOLS = 256;
+
+  while(true) {
+    std::array<uint8_t, 256> lengths{};
+    std::vector<std::pair<uint64_t, uint32_t>> heap; // weight and node, as a min heap
+    for(uint32_t s = 0; s < SYMBOLS; s++) {
+      if(counts[s] != 0) { heap.emplace_back(counts[s], s); }
+    }
+    if(heap.size() <= 1) {
+      if(!heap.empty()) { lengths[heap[0].second] = 1; }
+      return lengths;
+    }
+
+    // Leaves are nodes 0 to 255 and internal nodes follow in the order they are made, so each
+    //   internal node comes after its children and the root is made last.
+    auto heavier = [](const std::pair<uint64_t, uint32_t>& a, const std::pair<uint64_t, uint32_t>& b) { return a.first > b.first; };
+    std::make_heap(heap.begin(), heap.end(), heavier);
+    std::array<uint32_t, 2 * SYMBOLS - 1> parents{};
+    uint32_t nextNode = SYMBOLS;
+    while(heap.size() > 1) {
+      std::pop_heap(heap.begin(), heap.end(), heavier);
+      auto a = heap.back();
+      heap.pop_back();
+      std::pop_heap(heap.begin(), heap.end(), heavier);
+      auto b = heap.back();
+      heap.pop_back();
+      parents[a.second] = nextNode;
+      parents[b.second] = nextNode;
+      heap.emplace_back(a.first + b.first, nextNode++);
+      std::push_heap(heap.begin(), heap.end(), heavier);
+    }
+
+    std::array<uint32_t, 2 * SYMBOLS - 1> depths{};
+    for(uint32_t node = nextNode - 1; node-- > SYMBOLS; ) {
+      depths[node] = depths[parents[node]] + 1;
+    }
+    uint32_t longest = 0;
+    for(uint32_t s = 0; s < SYMBOLS; s++) {
+      if(counts[s] == 0) { continue; }
+      uint32_t length = depths[parents[s]] + 1;
+      lengths[s] = (uint8_t)std::min<uint32_t>(length, std::numeric_limits<uint8_t>::max());
+      longest = std::max(longest, length);
+    }
+    if(longest <= LITERAL_CODE_BITS) {
+      return lengths;
+    }
+
+    for(auto& count : counts) {
+      count = count == 0 ? 0 : (count >> 1) | 1;
+    }
+  }
+}
+
+// Returns the canonical code of every symbol, bit reversed to suit streams written least
+//   significant bit first.
+std::array<uint16_t, 256> canonicalCodes(const std::array<uint8_t, 256>& lengths) {
+  std::array<uint32_t, LITERAL_CODE_BITS + 1> perLength{};
+  for(auto length : lengths) {
+    perLength[length]++;
+  }
+  perLength[0] = 0;
+
+  std::array<uint32_t, LITERAL_CODE_BITS + 1> next{};
+  uint32_t code = 0;
+  for(unsigned length = 1; length <= LITERAL_CODE_BITS; length++) {
+    code = (code + perLength[length - 1]) << 1;
+    next[length] = code;
+  }
+
+  std::array<uint16_t, 256> codes{};
+  for(size_t s = 0; s < codes.size(); s++) {
+    if(lengths[s] == 0) { continue; }
+    uint32_t canonical = next[lengths[s]]++;
+    uint32_t reversed = 0;
+    for(unsigned bit = 0; bit < lengths[s]; bit++) {
+      reversed |= ((canonical >> bit) & 1) << (lengths[s] - 1 - bit);
+    }
+    codes[s] = (uint16_t)reversed;
+  }
+  return codes;
+}
+
+// Plans a code for literals whose byte values are counted, per stream, by histograms.
+// Returns nullopt if the coded section would not save LITERAL_CODE_MIN_GAIN_PER_MILLE of the
+//   literals.
+std::optional<LiteralCode> planLiteralCode(const std::array<LiteralHistogram, LITERAL_STREAMS>& histograms) {
+  LiteralCode code;
+  LiteralHistogram total{};
+  for(auto& histogram : histograms) {
+    for(size_t s = 0; s < total.size(); s++) {
+      total[s] += histogram[s];
+      code.literalCount += histogram[s];
+    }
+  }
+  if(code.literalCount == 0) { return std::nullopt; }
+
+  code.lengths = buildCodeLengths(total);
+  for(size_t i = 0; i < LITERAL_STREAMS; i++) {
+    uint64_t bits = 0;
+    for(size_t s = 0; s < total.size(); s++) {
+      bits += histograms[i][s] * code.lengths[s];
+    }
+    code.streamLengths[i] = (bits + 7) / 8;
+  }
+
+  uint64_t size = code.size();
+  if(size >= code.literalCount || (code.literalCount - size) * 1000 < code.literalCount * LITERAL_CODE_MIN_GAIN_PER_MILLE) {
+    return std::nullopt;
+  }
+  return code;
+}
+
+// Codes literals under code into out, which must be exactly code.size() bytes long.
+void encodeLiterals(std::span<const std::byte> literals, const LiteralCode& code, std::span<std::byte> out) {
+  if(literals.size() != code.literalCount || out.size() != code.size()) {
+    throw std::logic_error("Literal section does not match its code.");
+  }
+
+  LiteralCodeHeader header;
+  for(size_t i = 0; i < std::size(header.codeLengths); i++) {
+    header.codeLengths[i] = (uint8_t)(code.lengths[2 * i] | (code.lengths[2 * i + 1] << 4));
+  }
+  std::memcpy(header.streamLengths, code.streamLengths.data(), sizeof(header.streamLengths));
+  std::memcpy(out.data(), &header, sizeof(header));
+
+  auto codes = canonicalCodes(code.lengths);
+  uint64_t share = literalStreamShare(literals.size());
+  std::byte* outIter = out.data() + sizeof(header);
+  for(size_t i = 0; i < LITERAL_STREAMS; i++) {
+    auto stream = literals.subspan((size_t)std::min<uint64_t>(i * share, literals.size()));
+    stream = stream.first((size_t)std::min<uint64_t>(share, stream.size()));
+
+    std::byte* streamBegin = outIter;
+    uint64_t pending = 0;
+    unsigned pendingBits = 0;
+    for(auto literal : stream) {
+      auto symbol = (uint8_t)literal;
+      pending |= (uint64_t)codes[symbol] << pendingBits;
+      pendingBits += code.lengths[symbol];
+      if(pendingBits >= 32) {
+        for(int b = 0; b < 4; b++) {
+          *outIter++ = (std::byte)(pending >> (8 * b));
+        }
+        pending >>= 32;
+        pendingBits -= 32;
+      }
+    }
+    for(; pendingBits > 0; pendingBits -= std::min(pendingBits, 8u)) {
+      *outIter++ = (std::byte)pending;
+      pending >>= 8;
+    }
+
+    if((uint64_t)(outIter - streamBegin) != code.streamLengths[i]) {
+      throw std::logic_error("Literal stream does not match its planned length.");
+    }
+  }
+}
+
+// Returns the length of the coded literal section at the start of data, which may continue
+//   past its end. Throws if the section is truncated.
+uint64_t codedLiteralsLength(std::span<const std::byte> data) {
+  if(data.size() < sizeof(LiteralCodeHeader)) {
+    throw std::runtime_error("RLE frame is truncated.");
+  }
+  std::array<uint64_t, LITERAL_STREAMS> streamLengths;
+  std::memcpy(streamLengths.data(), data.data() + offsetof(LiteralCodeHeader, streamLengths), sizeof(streamLengths));
+
+  uint64_t length = sizeof(LiteralCodeHeader);
+  for(auto streamLength : streamLengths) {
+    if(streamLength > data.size() - length) {
+      throw std::runtime_error("RLE frame is truncated.");
+    }
+    length += streamLength;
+  }
+  return length;
+}
+
+// Decodes a coded literal section into out, which must be exactly as long as the literals it
+//   codes. Throws if the code is malformed or a stream does not decode to exactly its length.
+void decodeLiterals(std::span<const std::byte> coded, std::span<std::byte> out) {
+  constexpr uint32_t TABLE_SIZE = 1u << LITERAL_CODE_BITS;
+  constexpr uint64_t LOOKUP_MASK = TABLE_SIZE - 1;
+  constexpr size_t LOOKUPS_PER_LOAD = 5; // an unaligned 64 bit load holds at least 57 unread bits
+  constexpr size_t SYMBOLS_PER_LOOKUP = 2;
+  static_assert(LITERAL_STREAMS == 4, "The fast loop below is written out for four streams.");
+
+  if(codedLiteralsLength(coded) != coded.size()) {
+    throw std::runtime_error("RLE literal section does not match its length.");
+  }
+  LiteralCodeHeader header;
+  std::memcpy(&header, coded.data(), sizeof(header));
+  std::array<uint64_t, LITERAL_STREAMS> streamLengths;
+  std::memcpy(streamLengths.data(), header.streamLengths, sizeof(streamLengths));
+
+  // Each entry holds a symbol in its low byte and the length of its code in its high byte,
+  //   repeated for every lookup whose low bits are that code.
+  std::array<uint8_t, 256> lengths;
+  for(size_t i = 0; i < std::size(header.codeLengths); i++) {
+    lengths[2 * i] = (uint8_t)(header.codeLengths[i] & 0xF);
+    lengths[2 * i + 1] = (uint8_t)(header.codeLengths[i] >> 4);
+  }
+  uint64_t coverage = 0;
+  size_t symbolCount = 0;
+  for(auto length : lengths) {
+    if(length > LITERAL_CODE_BITS) {
+      throw std::runtime_error("RLE literal code is malformed.");
+    }
+    if(length != 0) {
+      coverage += TABLE_SIZE >> length;
+      symbolCount++;
+    }
+  }
+  bool sole = symbolCount == 1 && coverage == TABLE_SIZE / 2;
+  if(coverage != TABLE_SIZE && !sole) {
+    throw std::runtime_error("RLE literal code is malformed.");
+  }
+
+  std::array<uint16_t, TABLE_SIZE> table;
+  auto codes = canonicalCodes(lengths);
+  for(size_t s = 0; s < lengths.size(); s++) {
+    if(lengths[s] == 0) { continue; }
+    uint16_t entry = (uint16_t)(s | (lengths[s] << 8));
+    for(uint32_t k = codes[s]; k < TABLE_SIZE; k += sole ? 1 : 1u << lengths[s]) {
+      table[k] = entry;
+    }
+  }
+
+  // The fast loop looks up pairs: each entry holds the symbols in its low two bytes, then the
+  //   bits they take, then how many there are. A second symbol is paired only where its
+  //   code lies wholly within the lookup.
+  std::array<uint32_t, TABLE_SIZE> pairTable;
+  for(uint32_t k = 0; k < TABLE_SIZE; k++) {
+    uint32_t first = table[k];
+    uint32_t firstBits = first >> 8;
+    uint32_t second = table[k >> firstBits];
+    uint32_t secondBits = second >> 8;
+    if(firstBits + secondBits <= LITERAL_CODE_BITS) {
+      pairTable[k] = (first & 0xFF) | ((second & 0xFF) << 8) | ((firstBits + secondBits) << 16) | (2u << 24);
+    }
+    else {
+      pairTable[k] = (first & 0xFF) | (firstBits << 16) | (1u << 24);
+    }
+  }
+
+  std::array<const std::byte*, LITERAL_STREAMS> in;
+  std::array<uint64_t, LITERAL_STREAMS> inBits;
+  std::array<uint64_t, LITERAL_STREAMS> bitPos{};
+  std::array<std::byte*, LITERAL_STREAMS> outIter;
+  std::array<std::byte*, LITERAL_STREAMS> outEnd;
+  const std::byte* inIter = coded.data() + sizeof(header);
+  uint64_t share = literalStreamShare(out.size());
+  for(size_t i = 0; i < LITERAL_STREAMS; i++) {
+    in[i] = inIter;
+    inBits[i] = streamLengths[i] * 8;
+    inIter += (size_t)streamLengths[i];
+    outIter[i] = out.data() + (size_t)std::min<uint64_t>(i * share, out.size());
+    outEnd[i] = out.data() + (size_t)std::min<uint64_t>((i + 1) * share, out.size());
+  }
+
+  // While every stream has a whole load of input and room for its symbols, the streams are
+  //   decoded together, LOOKUPS_PER_LOAD pair lookups each per load. Every lookup stores two
+  //   bytes and keeps as many as it decoded. A load consumes at most 55 bits, which with the
+  //   up to 7 bits already skipped moves the next load at most seven bytes further on, and a
+  //   round stores no further than its most symbols, so the rounds which stay in bounds are
+  //   counted ahead rather than checked one by one: the first needs a whole 8 byte load and
+  //   each one after it at most seven bytes more.
+  while(true) {
+    uint64_t rounds = std::numeric_limits<uint64_t>::max();
+    for(size_t i = 0; i < LITERAL_STREAMS; i++) {
+      uint64_t inLeft = inBits[i] / 8 - bitPos[i] / 8;
+      uint64_t outLeft = (uint64_t)(outEnd[i] - outIter[i]);
+      if(inLeft < sizeof(uint64_t)) {
+        rounds = 0;
+        break;
+      }
+      rounds = std::min({ rounds, (inLeft - sizeof(uint64_t)) / 7 + 1, outLeft / (LOOKUPS_PER_LOAD * SYMBOLS_PER_LOOKUP) });
+    }
+    if(rounds == 0) { break; }
+
+    // The state of each stream is kept in its own locals so that it stays in registers: the
+    //   symbols are stored as bytes, which the compiler must assume alias any array.
+    const std::byte* in0 = in[0], *in1 = in[1], *in2 = in[2], *in3 = in[3];
+    uint64_t pos0 = bitPos[0], pos1 = bitPos[1], pos2 = bitPos[2], pos3 = bitPos[3];
+    std::byte* out0 = outIter[0], *out1 = outIter[1], *out2 = outIter[2], *out3 = outIter[3];
+    for(; rounds > 0; rounds--) {
+      // A sentinel bit above those a round can reach marks how far the stream has shifted,
+      //   so the bits consumed are found from it once per round rather than summed per symbol.
+      auto load = [](const std::byte* stream, uint64_t pos) {
+        uint64_t bits;
+        std::memcpy(&bits, stream + (size_t)(pos / 8), sizeof(bits));
+        uint64_t skipped = pos % 8;
+        return (bits >> skipped) | (1ull << (63 - skipped));
+      };
+      auto decodePair = [&](uint64_t& bits, std::byte*& symbols) {
+        uint32_t entry = pairTable[bits & LOOKUP_MASK];
+        std::memcpy(symbols, &entry, SYMBOLS_PER_LOOKUP);
+        bits >>= (entry >> 16) & 0xFF;
+        symbols += entry >> 24;
+      };
+      auto finish = [](uint64_t& pos, uint64_t bits) {
+        pos = pos / 8 * 8 + (uint64_t)std::countl_zero(bits);
+      };
+
+      uint64_t bits0 = load(in0, pos0), bits1 = load(in1, pos1), bits2 = load(in2, pos2), bits3 = load(in3, pos3);
+      for(size_t k = 0; k < LOOKUPS_PER_LOAD; k++) {
+        decodePair(bits0, out0);
+        decodePair(bits1, out1);
+        decodePair(bits2, out2);
+        decodePair(bits3, out3);
+      }
+      finish(pos0, bits0);
+      finish(pos1, bits1);
+      finish(pos2, bits2);
+      finish(pos3, bits3);
+    }
+    bitPos = { pos0, pos1, pos2, pos3 };
+    outIter = { out0, out1, out2, out3 };
+  }
+
+  // The ends of the streams are decoded one symbol at a time, reading no further than them.
+  for(size_t i = 0; i < LITERAL_STREAMS; i++) {
+    while(outIter[i] < outEnd[i]) {
+      uint64_t bits = 0;
+      uint64_t byte = bitPos[i] / 8;
+      for(unsigned b = 0; b < 3 && byte + b < inBits[i] / 8; b++) {
+        bits |= (uint64_t)in[i][(size_t)(byte + b)] << (8 * b);
+      }
+      uint16_t entry = table[(bits >> (bitPos[i] % 8)) & LOOKUP_MASK];
+      *outIter[i]++ = (std::byte)entry;
+      bitPos[i] += entry >> 8;
+      if(bitPos[i] > inBits[i]) {
+        throw std::runtime_error("RLE literal stream is truncated.");
+      }
+    }
+    if((bitPos[i] + 7) / 8 != inBits[i] / 8) {
+      throw std::runtime_error("RLE literal stream does not match its length.");
+    }
+  }
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include "RLE_Deflate.h"
+#include <bit>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+// Inputs which are near copies of each other, such as successive exports of the same tables,
+//   deflate best in the same way. A FormatCache remembers the way each kind of input was last
+//   deflated, keyed by a cheap fingerprint, so later inputs of the same kind can skip costing
+//   every node format.
+
+// Summarises data from its size class and how run-heavy evenly spaced samples of it are.
+//   Inputs which differ in detail but not in character share a fingerprint.
+uint64_t formatFingerprint(std::span<const std::byte> data) {
+  constexpr size_t SAMPLE_COUNT = 16;
+  constexpr size_t SAMPLE_BYTES = 1 << 12;
+  constexpr uint64_t SHORT_RUN_MAX = std::numeric_limits<uint8_t>::max();
+
+  // Bit length plus the two bits below the leading one, so sizes within about a quarter of
+  //   each other share a class.
+  uint64_t size = data.size();
+  uint64_t bits = (uint64_t)std::bit_width(size);
+  uint64_t fingerprint = (bits << 2) | ((bits > 2 ? size >> (bits - 3) : size) & 3);
+
+  // Each sample adds two bits for the share of it held in runs, in quarters, and one for
+  //   whether it holds runs too long for an 8 bit length.
+  size_t sampleLength = std::min<size_t>(SAMPLE_BYTES, data.size());
+  for(size_t k = 0; k < SAMPLE_COUNT; k++) {
+    auto sample = data.subspan((data.size() - sampleLength) * k / (SAMPLE_COUNT - 1), sampleLength);
+    uint64_t runBytes = 0;
+    bool longRuns = false;
+    for(size_t i = 0; i < sample.size(); ) {
+      size_t start = i;
+      while(++i < sample.size() && sample[i] == sample[start]) {}
+      if(i - start > sizeof(Node8x8)) {
+        runBytes += i - start;
+        longRuns = longRuns || i - start > SHORT_RUN_MAX;
+      }
+    }
+    uint64_t quarter = sample.empty() ? 0 : std::min<uint64_t>(runBytes * 4 / sample.size(), 3);
+    fingerprint = (fingerprint << 3) | (quarter << 1) | (longRuns ? 1 : 0);
+  }
+  return fingerprint;
+}
+
+struct FormatDecision {
+  NodeFormat format = NodeFormat::INEFFICIENT;
+  uint64_t blockSize = 0;
+  uint32_t savedPerMille = 0; // share of the input which deflating saved
+  uint32_t confirmations = 0; // inputs in a row which were deflated the same way
+};
+
+// class FormatCache
+// Remembers a FormatDecision per fingerprint in a small text file. Decisions are only
+//   trusted once CONFIDENT_CONFIRMATIONS inputs in a row have agreed on them. Safe to share
+//   between threads.
+class FormatCache {
+public:
+  static constexpr uint32_t CONFIDENT_CONFIRMATIONS = 2;
+  static constexpr uint32_t TOLERANCE_PER_MILLE = 20; // shortfall in savings a trusted decision may show
+
+  // Loads filename if it exists, skipping entries whose format is not a known NodeFormat.
+  //   Nothing is written until save() is called.
+  explicit FormatCache(std::string filename) :
+    filename(std::move(filename))
+  {
+    std::ifstream in(this->filename);
+    uint64_t fingerprint;
+    int format;
+    FormatDecision decision;
+    while(in >> std::hex >> fingerprint >> std::dec >> format >> decision.blockSize >> decision.savedPerMille >> decision.confirmations) {
+      if(!knownFormat(format)) { continue; }
+      decision.format = (NodeFormat)format;
+      decisions[fingerprint] = decision;
+    }
+  }
+
+  std::optional<FormatDecision> find(uint64_t fingerprint) const {
+    std::lock_guard lock(mutex);
+    auto iter = decisions.find(fingerprint);
+    if(iter == decisions.end()) { return std::nullopt; }
+    return iter->second;
+  }
+
+  // Records how an input was deflated. Agreeing with the decision already held confirms it,
+  //   and disagreeing replaces it.
+  void record(uint64_t fingerprint, NodeFormat format, uint64_t blockSize, uint32_t savedPerMille) {
+    std::lock_guard lock(mutex);
+    auto& decision = decisions[fingerprint];
+    if(decision.format == format && decision.blockSize == blockSize) {
+      decision.confirmations++;
+    }
+    else {
+      decision = { format, blockSize, 0, 1 };
+    }
+    decision.savedPerMille = savedPerMille;
+  }
+
+  void save() const {
+    std::lock_guard lock(mutex);
+    std::ofstream out(filename, std::ios::trunc);
+    for(auto& [fingerprint, decision] : decisions) {
+      out << std::hex << fingerprint << std::dec << ' ' << (int)decision.format << ' ' << decision.blockSize << ' '
+          << decision.savedPerMille << ' ' << decision.confirmations << '\n';
+    }
+    if(!out) {
+      throw std::runtime_error("Failed to write format cache " + filename);
+    }
+  }
+
+private:
+  // Whether format is a value record() can have been given: a NodeFormat or INEFFICIENT.
+  static bool knownFormat(int format) {
+    switch((NodeFormat)format) {
+    case NodeFormat::P8L8:
+    case NodeFormat::P8L16:
+    case NodeFormat::P16L8:
+    case NodeFormat::P16L16:
+    case NodeFormat::INEFFICIENT:
+      return true;
+    }
+    return false;
+  }
+
+  std::string filename;
+  mutable std::mutex mutex;
+  std::unordered_map<uint64_t, FormatDecision> decisions;
+
+};
+
+uint32_t savingsPerMille(const DeflatePlan& plan, uint64_t inputLength) {
+  return plan.size() < inputLength ? (uint32_t)((inputLength - plan.size()) * 1000 / inputLength) : 0;
+}
+
+// The node format covering the most input among the frames of plan which have a table.
+NodeFormat dominantFormat(const DeflatePlan& plan) {
+  std::unordered_map<NodeFormat, uint64_t> coverage;
+  for(size_t i = 0; i < plan.tables.size(); i++) {
+    if(plan.tables[i].nodeCount != 0) {
+      coverage[plan.tables[i].format] += plan.blocks[i].size();
+    }
+  }
+
+  auto best = std::max_element(coverage.begin(), coverage.end(), [](auto& a, auto& b) { return a.second < b.second; });
+  return best == coverage.end() ? NodeFormat::INEFFICIENT : best->first;
+}
+
+// As deflateFile(), consulting cache for how to deflate the input. Without options.blockSize,
+//   the block size of the cached decision is used. Once the decision is trusted, every frame
+//   takes its node format without costing the others, and should the input then save less
+//   than the decision promised, it is planned again in full. The outcome is recorded in cache
+//   either way. Deflating within options.maxMemory bypasses the cache.
+void deflateFileCached(const std::string& inputFilename, const std::string& outputFilename, FormatCache& cache, const DeflateOptions& options = {}) {
+  MappedFile inMap(inputFilename, MappedFile::CreationDisposition::OPEN);
+  if(options.maxMemory != 0 || inMap.size() == 0) {
+    deflateFile(inputFilename, outputFilename, options);
+    return;
+  }
+  auto inView = inMap.getView(0, inMap.size());
+
+  auto fingerprint = formatFingerprint(inView);
+  auto cached = cache.find(fingerprint);
+  DeflateOptions tuned = options;
+  if(cached && tuned.blockSize == 0) {
+    tuned.blockSize = cached->blockSize;
+  }
+  bool predicted = cached && cached->confirmations >= FormatCache::CONFIDENT_CONFIRMATIONS && cached->format != NodeFormat::INEFFICIENT &&
+                   tuned.format == NodeFormat::INEFFICIENT && tuned.blockSize == cached->blockSize;
+  if(predicted) {
+    tuned.format = cached->format;
+  }
+
+  auto plan = planDeflate(inView, tuned);
+  if(predicted && savingsPerMille(plan, inView.size()) + FormatCache::TOLERANCE_PER_MILLE < cached->savedPerMille) {
+    tuned.format = options.format;
+    plan = planDeflate(inView, tuned);
+  }
+  cache.record(fingerprint, dominantFormat(plan), tuned.blockSize, savingsPerMille(plan, inView.size()));
+
+  if(!plan.compressible()) {
+    throw std::runtime_error("Cannot deflate this file efficiently.");
+  }
+
+  OutputCleanup cleanup(outputFilename);
+  MappedFile outMap(outputFilename, MappedFile::CreationDisposition::CREATE, plan.size());
+  cleanup.created();
+  auto outView = outMap.getView(0, outMap.size());
+  plan.write(outView);
+  cleanup.commit();
+}
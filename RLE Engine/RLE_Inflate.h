@@ -1,100 +1,702 @@
 #pragma once
 #include "RLE_Shared.h"
+#include "RLE_Checksum.h"
+#include "RLE_Entropy.h"
+#include <memory>
 #include <vector>
+#include <algorithm>
+#include <cstring>
 
 template <class NodeType>
-std::vector<Run> extractTable(const void* data, size_t nodeCount) {
+std::vector<Run> extractTable(const void* data, size_t nodeCount, uint8_t flags, uint64_t decompressedLength) {
   std::vector<Run> outVec;
   outVec.reserve(nodeCount);
 
   std::span<const NodeType> nodes(reinterpret_cast<const NodeType*>(data), nodeCount);
+  decodeNodes(nodes, flags, decompressedLength, [&](const Run& run) { outVec.push_back(run); });
+  return outVec;
+}
+
+std::vector<Run> extractTableByFormat(const void* data, size_t nodeCount, NodeFormat format, uint8_t flags, uint64_t decompressedLength) {
+  switch(format) {
+  case NodeFormat::P8L8:   return extractTable<Node8x8  >(data, nodeCount, flags, decompressedLength);
+  case NodeFormat::P8L16:  return extractTable<Node8x16 >(data, nodeCount, flags, decompressedLength);
+  case NodeFormat::P16L8:  return extractTable<Node16x8 >(data, nodeCount, flags, decompressedLength);
+  case NodeFormat::P16L16: return extractTable<Node16x16>(data, nodeCount, flags, decompressedLength);
+  };
+
+  throw std::logic_error("Failed to switch by format type.");
+}
+
+size_t nodeSizeByFormat(NodeFormat format) {
+  switch(format) {
+  case NodeFormat::P8L8:   return sizeof(Node8x8);
+  case NodeFormat::P8L16:  return sizeof(Node8x16);
+  case NodeFormat::P16L8:  return sizeof(Node16x8);
+  case NodeFormat::P16L16: return sizeof(Node16x16);
+  };
+
+  throw std::runtime_error("Unrecognized RLE node format.");
+}
+
+// struct RLEFrame
+// A decoded view of one frame of an RLE image. The spans point into the image itself, except
+//   that the literals of an entropy coded section point into decodedLiterals. Frames are read
+//   with such a section left coded and no literals, and it is only decoded where literals
+//   are needed: see decodeFrameLiterals() and frameLiterals().
+struct RLEFrame {
+  const Header* header = nullptr;
+  NodeFormat format = NodeFormat::INEFFICIENT;
+  std::vector<Run> runs;
+  std::span<const std::byte> head;     // header and node table
+  std::span<const std::byte> literals;
+  uint64_t literalCount = 0;
+  std::span<const std::byte> codedLiterals; // the literal section as stored, when entropy coded
+  std::shared_ptr<const std::vector<std::byte>> decodedLiterals;
+  const FrameChecksum* checksum = nullptr;
+  std::span<const std::byte> bytes;    // the entire frame, including any checksum record
+
+  uint64_t decompressedLength() const { return header->decompressedLength; }
+};
+
+// Decodes the entropy coded literal section of frame, so that frame.literals holds them.
+void decodeFrameLiterals(RLEFrame& frame) {
+  auto decoded = std::make_shared<std::vector<std::byte>>((size_t)frame.literalCount);
+  decodeLiterals(frame.codedLiterals, *decoded);
+  frame.literals = *decoded;
+  frame.decodedLiterals = std::move(decoded);
+}
+
+// Returns the literals of frame. An entropy coded section which has not been decoded into
+//   the frame is decoded into scratch, for as long as the caller keeps it.
+std::span<const std::byte> frameLiterals(const RLEFrame& frame, std::vector<std::byte>& scratch) {
+  if(frame.codedLiterals.empty() || frame.decodedLiterals) {
+    return frame.literals;
+  }
+  scratch.resize((size_t)frame.literalCount);
+  decodeLiterals(frame.codedLiterals, scratch);
+  return scratch;
+}
+
+// Decodes the frame at the start of data, which may continue past the end of the frame.
+//   An entropy coded literal section is left coded.
+// Throws if the frame is malformed or truncated.
+RLEFrame readFrame(std::span<const std::byte> data) {
+  if(data.size() < sizeof(Header)) {
+    throw std::runtime_error("RLE frame is too short to contain a header.");
+  }
+
+  RLEFrame frame;
+  frame.header = reinterpret_cast<const Header*>(data.data());
+  frame.format = frame.header->checkMagic();
+  uint64_t tableByteSize = (uint64_t)frame.header->tableNodeCount * nodeSizeByFormat(frame.format);
+  if(data.size() - sizeof(Header) < tableByteSize) {
+    throw std::runtime_error("RLE frame is too short to contain its node table.");
+  }
+  frame.runs = extractTableByFormat(data.data() + sizeof(Header), frame.header->tableNodeCount, frame.format, frame.header->flags(), frame.decompressedLength());
+  frame.head = data.first(sizeof(Header) + (size_t)tableByteSize);
+
+  uint64_t prefixTotal = 0;
+  uint64_t lengthTotal = 0;
+  for(auto& run : frame.runs) {
+    prefixTotal += run.prefix;
+    if(run.distance != 0 && !matchWithinRestart(prefixTotal + lengthTotal, run.length, run.distance)) {
+      throw std::runtime_error("RLE back reference reaches outside its restart interval.");
+    }
+    lengthTotal += run.length;
+  }
+  if(lengthTotal > frame.decompressedLength() || prefixTotal > frame.decompressedLength() - lengthTotal) {
+    throw std::runtime_error("RLE node table does not match expected length.");
+  }
+
+  frame.literalCount = frame.decompressedLength() - lengthTotal;
+  bool coded = frame.header->hasFlag(FrameFlag::CODED_LITERALS);
+  uint64_t sectionLength = coded ? codedLiteralsLength(data.subspan(frame.head.size())) : frame.literalCount;
+  uint64_t checksumLength = frame.header->hasFlag(FrameFlag::CHECKSUM) ? sizeof(FrameChecksum) : 0;
+  if(data.size() - frame.head.size() < sectionLength + checksumLength) {
+    throw std::runtime_error("RLE frame is truncated.");
+  }
+  auto section = data.subspan(frame.head.size(), (size_t)sectionLength);
+  if(coded) {
+    frame.codedLiterals = section;
+  }
+  else {
+    frame.literals = section;
+  }
+  if(checksumLength) {
+    frame.checksum = reinterpret_cast<const FrameChecksum*>(section.data() + section.size());
+  }
+  frame.bytes = data.first(frame.head.size() + (size_t)(sectionLength + checksumLength));
+  return frame;
+}
+
+template <class NodeType>
+uint64_t tableRunLength(const void* data, size_t nodeCount, uint8_t flags, uint64_t decompressedLength) {
+  uint64_t lengthTotal = 0;
+  std::span<const NodeType> nodes(reinterpret_cast<const NodeType*>(data), nodeCount);
+  decodeNodes(nodes, flags, decompressedLength, [&](const Run& run) { lengthTotal += run.length; });
+  return lengthTotal;
+}
+
+// Returns the length in bytes of the frame at the start of data, as readFrame() would find
+//   it. Its node table is only summed, so no runs are built, and its literal section is not
+//   touched unless entropy coded, when only the section's own header is read.
+uint64_t frameByteLength(std::span<const std::byte> data) {
+  if(data.size() < sizeof(Header)) {
+    throw std::runtime_error("RLE frame is too short to contain a header.");
+  }
+
+  auto header = reinterpret_cast<const Header*>(data.data());
+  auto format = header->checkMagic();
+  uint64_t tableByteSize = (uint64_t)header->tableNodeCount * nodeSizeByFormat(format);
+  if(data.size() - sizeof(Header) < tableByteSize) {
+    throw std::runtime_error("RLE frame is too short to contain its node table.");
+  }
+  auto table = data.data() + sizeof(Header);
+
+  uint64_t runLength = 0;
+  switch(format) {
+  case NodeFormat::P8L8:   runLength = tableRunLength<Node8x8  >(table, header->tableNodeCount, header->flags(), header->decompressedLength); break;
+  case NodeFormat::P8L16:  runLength = tableRunLength<Node8x16 >(table, header->tableNodeCount, header->flags(), header->decompressedLength); break;
+  case NodeFormat::P16L8:  runLength = tableRunLength<Node16x8 >(table, header->tableNodeCount, header->flags(), header->decompressedLength); break;
+  case NodeFormat::P16L16: runLength = tableRunLength<Node16x16>(table, header->tableNodeCount, header->flags(), header->decompressedLength); break;
+  default: throw std::logic_error("Failed to switch by format type.");
+  }
+
+  uint64_t headLength = sizeof(Header) + tableByteSize;
+  bool coded = header->hasFlag(FrameFlag::CODED_LITERALS);
+  uint64_t sectionLength = coded ? codedLiteralsLength(data.subspan((size_t)headLength)) : header->decompressedLength - runLength;
+  uint64_t checksumLength = header->hasFlag(FrameFlag::CHECKSUM) ? sizeof(FrameChecksum) : 0;
+  if(data.size() - headLength < sectionLength + checksumLength) {
+    throw std::runtime_error("RLE frame is truncated.");
+  }
+  return headLength + sectionLength + checksumLength;
+}
+
+// Entropy coded literal sections are left coded, so reading costs only the node tables.
+std::vector<RLEFrame> readFrames(std::span<const std::byte> data) {
+  std::vector<RLEFrame> frames;
+  while(!data.empty()) {
+    frames.push_back(readFrame(data));
+    data = data.subspan(frames.back().bytes.size());
+  }
+  return frames;
+}
+
+// struct FrameIndex
+// Seek index over a frame: where each run's literal prefix begins, both in the decompressed
+//   content and in the literal section. A final point marks the trailing literals.
+struct FrameIndex {
+  struct SeekPoint {
+    uint64_t decompressedOffset;
+    uint64_t literalOffset;
+  };
+
+  explicit FrameIndex(const RLEFrame& frame) {
+    points.reserve(frame.runs.size() + 1);
+    SeekPoint point{ 0, 0 };
+    for(auto& run : frame.runs) {
+      points.push_back(point);
+      point.decompressedOffset += run.prefix + run.length;
+      point.literalOffset += run.prefix;
+    }
+    points.push_back(point);
+  }
+
+  // Returns the index of the run whose prefix or body contains offset. If offset lies in the
+  //   trailing literals, returns the run count.
+  size_t find(uint64_t offset) const {
+    auto iter = std::upper_bound(points.begin(), points.end(), offset, [](uint64_t value, const SeekPoint& point) {
+      return value < point.decompressedOffset;
+    });
+    return (size_t)(iter - points.begin()) - 1;
+  }
+
+  std::vector<SeekPoint> points;
+};
+
+// Fills out with pattern repeated from phase on, which is what a back reference produces when
+//   pattern is the distance bytes before it, even where it overlaps its own output. Each pass
+//   copies all that is filled so far, so long references run at memory speed.
+void fillPattern(std::span<std::byte> out, std::span<const std::byte> pattern, size_t phase) {
+  if(phase == 0 && out.size() <= pattern.size()) {
+    std::memcpy(out.data(), pattern.data(), out.size());
+    return;
+  }
+
+  size_t first = std::min(out.size(), pattern.size() - phase);
+  std::memcpy(out.data(), pattern.data() + phase, first);
+  size_t filled = std::min(out.size(), pattern.size());
+  std::memcpy(out.data() + first, pattern.data(), filled - first);
+  while(filled < out.size()) {
+    size_t count = std::min(filled, out.size() - filled);
+    std::memcpy(out.data() + filled, out.data(), count);
+    filled += count;
+  }
+}
+
+// Copies a back reference of length bytes to out from distance bytes before it, in the same
+//   buffer. One that does not overlap its output is a single copy. One that does is copied in
+//   16 byte chunks, each reading only bytes already written: a distance shorter than a chunk
+//   is first widened to a whole number of its patterns. What is left is copied bytewise.
+void copyBackReference(std::byte* out, size_t distance, size_t length) {
+  constexpr size_t CHUNK = 16;
+
+  if(distance >= length) {
+    std::memcpy(out, out - distance, length);
+    return;
+  }
+
+  size_t i = 0;
+  if(distance < CHUNK) {
+    size_t stride = (CHUNK + distance - 1) / distance * distance;
+    for(; i < std::min(length, stride); i++) {
+      out[i] = out[i - distance];
+    }
+    distance = stride;
+  }
+  for(; i + CHUNK <= length; i += CHUNK) {
+    std::memcpy(out + i, out + i - distance, CHUNK);
+  }
+  for(; i < length; i++) {
+    out[i] = out[i - distance];
+  }
+}
+
+// class MatchWindow
+// The last MATCH_WINDOW bytes of content passed through it, which is all a back reference
+//   can copy from.
+class MatchWindow {
+public:
+  void append(std::span<const std::byte> content) {
+    size_t count = std::min(content.size(), bytes.size());
+    std::memmove(bytes.data(), bytes.data() + count, bytes.size() - count);
+    std::memcpy(bytes.data() + bytes.size() - count, content.data() + content.size() - count, count);
+    filled = std::min(filled + count, bytes.size());
+  }
+
+  void append(std::byte value, uint64_t length) {
+    size_t count = (size_t)std::min<uint64_t>(length, bytes.size());
+    std::memmove(bytes.data(), bytes.data() + count, bytes.size() - count);
+    std::memset(bytes.data() + bytes.size() - count, (int)value, count);
+    filled = std::min(filled + count, bytes.size());
+  }
+
+  // Appends what a back reference of length bytes at distance produces, without expanding
+  //   more of it than the window holds.
+  void appendMatch(uint64_t distance, uint64_t length) {
+    std::array<std::byte, MATCH_WINDOW> piece;
+    size_t count = (size_t)std::min<uint64_t>(length, piece.size());
+    fillPattern(std::span(piece).first(count), last(distance), (size_t)((length - count) % distance));
+    append(std::span(piece).first(count));
+  }
+
+  // The distance bytes a back reference of that distance repeats.
+  std::span<const std::byte> last(uint64_t distance) const {
+    if(distance > filled) {
+      throw std::runtime_error("RLE back reference reaches before the content walked.");
+    }
+    return std::span(bytes).last((size_t)distance);
+  }
+
+private:
+  std::array<std::byte, MATCH_WINDOW> bytes{};
+  size_t filled = 0;
+
+};
+
+// Walks the decompressed content of frame over [begin, end) without materializing it.
+// Literal stretches are passed to onLiterals(span) and runs to onRun(value, length), in order.
+//   Back references which copy only from content already passed on are offered to
+//   onMatch(distance, length), and taken if it returns true. The content of the rest is
+//   expanded and passed as literals, which only live for the call. Since back references copy
+//   from earlier content, frames holding them are walked from the restart point before begin,
+//   though nothing before begin is passed on. An entropy coded section which has not been
+//   decoded into the frame is decoded for the call, so callers walking one frame many times
+//   should decode it once with decodeFrameLiterals().
+template <class LiteralFunc, class RunFunc, class MatchFunc>
+void walkFrame(const RLEFrame& frame, const FrameIndex& index, uint64_t begin, uint64_t end, LiteralFunc&& onLiterals, RunFunc&& onRun, MatchFunc&& onMatch) {
+  constexpr size_t MATCH_CHUNK = 1 << 12;
+
+  std::vector<std::byte> decoded;
+  auto section = frameLiterals(frame, decoded);
 
-  Run run{};
-  for(auto iter = nodes.begin(); iter != nodes.end(); iter++) {
-    if(iter->length == 0) {
-      if(iter->value == (std::byte)0) { //signal&long node
-        run.prefix += iter->prefix;
-        iter++;
-        run.length = iter->getLongLength();
-        run.value = iter->value;
-
-        outVec.push_back(run);
-        run.prefix = 0;
-        run.length = 0;
-        run.value = (std::byte)0;
-
-        continue;
+  bool matches = frame.header->hasFlag(FrameFlag::MATCHES);
+  MatchWindow window;
+  uint64_t pos = matches ? begin / MATCH_RESTART_INTERVAL * MATCH_RESTART_INTERVAL : begin;
+  auto passLiterals = [&](std::span<const std::byte> literals) {
+    if(matches) { window.append(literals); }
+    if(pos + literals.size() > begin) {
+      onLiterals(literals.subspan((size_t)(begin > pos ? begin - pos : 0)));
+    }
+    pos += literals.size();
+  };
+  auto passRun = [&](std::byte value, uint64_t length) {
+    if(matches) { window.append(value, length); }
+    if(pos + length > begin) {
+      onRun(value, pos + length - std::max(pos, begin));
+    }
+    pos += length;
+  };
+  auto passMatch = [&](uint64_t distance, uint64_t length) {
+    if(pos >= begin + distance && onMatch(distance, length)) {
+      window.appendMatch(distance, length);
+      pos += length;
+      return;
+    }
+    std::array<std::byte, MATCH_CHUNK> chunk;
+    while(length > 0) {
+      auto piece = std::span(chunk).first((size_t)std::min<uint64_t>(length, chunk.size()));
+      fillPattern(piece, window.last(distance), 0);
+      passLiterals(piece);
+      length -= piece.size();
+    }
+  };
+
+  for(size_t i = index.find(pos); i < index.points.size() && pos < end; i++) {
+    auto& point = index.points[i];
+    bool trailing = i == frame.runs.size();
+    uint64_t prefix = trailing ? section.size() - point.literalOffset : frame.runs[i].prefix;
+
+    uint64_t literalEnd = point.decompressedOffset + prefix;
+    if(pos < literalEnd) {
+      uint64_t stop = std::min(literalEnd, end);
+      passLiterals(section.subspan((size_t)(point.literalOffset + (pos - point.decompressedOffset)), (size_t)(stop - pos)));
+    }
+
+    if(trailing) { break; }
+    auto& run = frame.runs[i];
+    uint64_t runEnd = literalEnd + run.length;
+    if(pos < end && pos < runEnd) {
+      uint64_t stop = std::min(runEnd, end);
+      if(run.distance != 0) {
+        passMatch(run.distance, stop - pos);
       }
-      else { //skip node
-        run.prefix += iter->getSkipLength();
-        continue;
+      else {
+        passRun(run.value, stop - pos);
       }
     }
+  }
+}
 
-    //standard
-    run.prefix += iter->prefix;
-    run.length = iter->length;
-    run.value = iter->value;
+// As above, with every back reference expanded.
+template <class LiteralFunc, class RunFunc>
+void walkFrame(const RLEFrame& frame, const FrameIndex& index, uint64_t begin, uint64_t end, LiteralFunc&& onLiterals, RunFunc&& onRun) {
+  walkFrame(frame, index, begin, end, onLiterals, onRun, [](uint64_t, uint64_t) { return false; });
+}
 
-    outVec.push_back(run);
-    run.prefix = 0;
-    run.length = 0;
-    run.value = (std::byte)0;
+// Inflates frame into the out segments, which together must be exactly
+//   frame.decompressedLength() bytes long.
+// Frames carrying a checksum are verified on the fly: the copy kernel folds literals into
+//   both CRCs and runs are applied in closed form, so verification adds no extra pass. Back
+//   references are hashed as they are expanded. An entropy coded section is checked against
+//   the compressed CRC before it is decoded, and unless it was already decoded into the
+//   frame, it is decoded here for just as long as the frame takes to inflate.
+void inflateFrame(const RLEFrame& frame, std::span<const std::span<std::byte>> outSegments) {
+  if(segmentsLength(outSegments) != frame.decompressedLength()) {
+    throw std::runtime_error("Inflated file does not match expected length.");
   }
 
-  return outVec;
+  bool verify = frame.checksum != nullptr;
+  std::array<uint32_t, 2> crcs{ ~0u, ~0u }; // compressed, decompressed
+  bool coded = !frame.codedLiterals.empty();
+  if(verify) {
+    crcs[0] = crc32cUpdate(crcs[0], frame.head);
+    if(coded && ~crc32cUpdate(crcs[0], frame.codedLiterals) != frame.checksum->compressed) {
+      throw std::runtime_error("RLE frame failed compressed checksum verification.");
+    }
+  }
+
+  std::vector<std::byte> decoded;
+  auto literals = frameLiterals(frame, decoded);
+  SegmentCursor out(outSegments);
+  uint64_t written = 0;
+  auto copyLiterals = [&](uint64_t count) {
+    written += count;
+    out.advance(count, [&](std::span<std::byte> piece) {
+      auto chunk = literals.first(piece.size());
+      if(verify) {
+        copyCrc32c(chunk, piece.data(), crcs);
+      }
+      else {
+        std::copy(chunk.begin(), chunk.end(), piece.data());
+      }
+      literals = literals.subspan(piece.size());
+    });
+  };
+
+  // A back reference repeats bytes already inflated. Within one output segment it is copied
+  //   in place, and otherwise the bytes are gathered first in case the output is split where
+  //   they lie.
+  auto copyMatch = [&](uint64_t distance, uint64_t length) {
+    if(outSegments.size() == 1) {
+      std::span<std::byte> piece(outSegments[0].data() + written, (size_t)length);
+      copyBackReference(piece.data(), (size_t)distance, piece.size());
+      if(verify) {
+        crcs[1] = crc32cUpdate(crcs[1], piece);
+      }
+      out.advance(length, [](std::span<std::byte>) {});
+      written += length;
+      return;
+    }
+
+    std::array<std::byte, MATCH_WINDOW> window;
+    auto pattern = std::span(window).first((size_t)distance);
+    readSegments(outSegments, written - distance, pattern);
+    size_t phase = 0;
+    out.advance(length, [&](std::span<std::byte> piece) {
+      fillPattern(piece, pattern, phase);
+      phase = (size_t)((phase + piece.size()) % distance);
+      if(verify) {
+        crcs[1] = crc32cUpdate(crcs[1], piece);
+      }
+    });
+    written += length;
+  };
+
+  for(auto& node : frame.runs) {
+    copyLiterals(node.prefix);
+    if(node.distance != 0) {
+      copyMatch(node.distance, node.length);
+      continue;
+    }
+    written += node.length;
+    out.advance(node.length, [&](std::span<std::byte> piece) {
+      std::fill(piece.begin(), piece.end(), node.value);
+    });
+    if(verify) {
+      crcs[1] = crc32cUpdate(crcs[1], node.value, node.length);
+    }
+  }
+  copyLiterals(literals.size());
+  if(verify && !coded && ~crcs[0] != frame.checksum->compressed) {
+    throw std::runtime_error("RLE frame failed compressed checksum verification.");
+  }
+  if(verify && ~crcs[1] != frame.checksum->decompressed) {
+    throw std::runtime_error("RLE frame failed decompressed checksum verification.");
+  }
 }
 
-std::vector<Run> extractTableByFormat(const void* data, size_t nodeCount, NodeFormat format) {
-  switch(format) {
-  case NodeFormat::P8L8:   return extractTable<Node8x8  >(data, nodeCount);
-  case NodeFormat::P8L16:  return extractTable<Node8x16 >(data, nodeCount);
-  case NodeFormat::P16L8:  return extractTable<Node16x8 >(data, nodeCount);
-  case NodeFormat::P16L16: return extractTable<Node16x16>(data, nodeCount);
+void inflateFrame(const RLEFrame& frame, const std::span<std::byte>& out) {
+  inflateFrame(frame, std::span<const std::span<std::byte>>(&out, 1));
+}
+
+uint64_t totalDecompressedLength(const std::vector<RLEFrame>& frames) {
+  uint64_t length = 0;
+  for(auto& frame : frames) {
+    length += frame.decompressedLength();
+  }
+  return length;
+}
+
+// Inflates frames back to back into out, which must be exactly their decompressed length.
+// Frames are independent, so when threaded they are inflated (and verified) concurrently.
+// cancellation is checked before each frame.
+void inflateFrames(const std::vector<RLEFrame>& frames, std::span<std::byte> out, bool threaded = true, const CancellationToken& cancellation = {}) {
+  std::vector<uint64_t> offsets;
+  offsets.reserve(frames.size());
+  uint64_t offset = 0;
+  for(auto& frame : frames) {
+    offsets.push_back(offset);
+    offset += frame.decompressedLength();
+  }
+  if(offset != out.size()) {
+    throw std::runtime_error("Inflated file does not match expected length.");
+  }
+
+  auto inflateOne = [&](size_t i) {
+    cancellation.throwIfCancelled();
+    inflateFrame(frames[i], out.subspan((size_t)offsets[i], (size_t)frames[i].decompressedLength()));
   };
+  if(threaded) {
+    parallelFor(frames.size(), inflateOne);
+  }
+  else {
+    for(size_t i = 0; i < frames.size(); i++) { inflateOne(i); }
+  }
+}
 
-  throw std::logic_error("Failed to switch by format type.");
+// Inflates rleData into the out segments, which are treated as one stream and together must
+//   be exactly its decompressed length, so output can land directly in discontiguous buffers.
+//   Frames are inflated concurrently, each into the pieces of the segments it covers.
+void inflateScatter(std::span<const std::byte> rleData, std::span<const std::span<std::byte>> outSegments, const CancellationToken& cancellation = {}) {
+  auto frames = readFrames(rleData);
+  if(totalDecompressedLength(frames) != segmentsLength(outSegments)) {
+    throw std::runtime_error("Inflated file does not match expected length.");
+  }
+
+  std::vector<uint64_t> offsets;
+  offsets.reserve(frames.size());
+  uint64_t offset = 0;
+  for(auto& frame : frames) {
+    offsets.push_back(offset);
+    offset += frame.decompressedLength();
+  }
+
+  parallelFor(frames.size(), [&](size_t i) {
+    cancellation.throwIfCancelled();
+    inflateFrame(frames[i], sliceSegments(outSegments, offsets[i], frames[i].decompressedLength()));
+  });
 }
 
-void inflateFile(const std::string& inputFilename, const std::string& outputFilename) {
+void inflateFile(const std::string& inputFilename, const std::string& outputFilename, const CancellationToken& cancellation = {}) {
   auto inMap = MappedFile(inputFilename, MappedFile::CreationDisposition::OPEN);
   auto inView = inMap.getView(0, inMap.size());
-  auto inIter = inView.begin();
+  auto frames = readFrames(inView);
 
-  const Header* header = reinterpret_cast<Header*>(inView.data());
-  inIter += sizeof(Header);
-  auto format = header->checkMagic();
-  size_t nodeSize = 0;
-  switch(format) {
-  case NodeFormat::P8L8:   nodeSize = sizeof(Node8x8);   break;
-  case NodeFormat::P8L16:  nodeSize = sizeof(Node8x16);  break;
-  case NodeFormat::P16L8:  nodeSize = sizeof(Node16x8);  break;
-  case NodeFormat::P16L16: nodeSize = sizeof(Node16x16); break;
+  OutputCleanup cleanup(outputFilename);
+  auto outMap = MappedFile(outputFilename, MappedFile::CreationDisposition::CREATE, totalDecompressedLength(frames));
+  cleanup.created();
+  auto outView = outMap.getView(0, outMap.size());
+  inflateFrames(frames, outView, true, cancellation);
+  cleanup.commit();
+}
+
+// Returns how far the inflated content of frames runs ahead of the part of rleData, which
+//   holds them, still to be read: the least offset at which rleData may start within the
+//   output for it to be inflated in place. Literals, frame heads and checksum records are
+//   read as inflate reaches them, so each must still be intact by then. Entropy coded
+//   literals are all read along with the head, since they are decoded before the frame is
+//   inflated.
+uint64_t inPlaceLead(std::span<const std::byte> rleData, const std::vector<RLEFrame>& frames) {
+  int64_t lead = 0;
+  uint64_t written = 0;
+  auto mustRead = [&](const std::byte* position) {
+    lead = std::max(lead, (int64_t)written - (position - rleData.data()));
+  };
+
+  for(auto& frame : frames) {
+    mustRead(frame.head.data());
+    if(!frame.codedLiterals.empty()) {
+      written += frame.decompressedLength();
+      if(frame.checksum) {
+        mustRead(reinterpret_cast<const std::byte*>(frame.checksum));
+      }
+      continue;
+    }
+
+    uint64_t literalOffset = 0;
+    for(auto& run : frame.runs) {
+      mustRead(frame.literals.data() + literalOffset);
+      written += run.prefix + run.length;
+      literalOffset += run.prefix;
+    }
+    mustRead(frame.literals.data() + literalOffset);
+    written += frame.literals.size() - literalOffset;
+    if(frame.checksum) {
+      mustRead(reinterpret_cast<const std::byte*>(frame.checksum));
+    }
   }
+  return (uint64_t)lead;
+}
 
-  size_t tableByteSize = header->tableNodeCount * nodeSize;
-  auto table = extractTableByFormat(inView.data() + sizeof(Header), header->tableNodeCount, format);
-  inIter += tableByteSize;
+// Returns how many bytes beyond its decompressed length a buffer must have for rleData to be
+//   inflated within it by inflateInPlace().
+uint64_t inflateInPlaceMargin(std::span<const std::byte> rleData) {
+  auto frames = readFrames(rleData);
+  uint64_t needed = inPlaceLead(rleData, frames) + rleData.size();
+  uint64_t length = totalDecompressedLength(frames);
+  return needed > length ? needed - length : 0;
+}
 
-  auto outMap = MappedFile(outputFilename, MappedFile::CreationDisposition::CREATE, header->decompressedLength);
-  auto outView = outMap.getView(0, outMap.size());
+// Inflates an RLE image held in the last compressedLength bytes of buffer into the front of
+//   the same buffer, which must be at least inflateInPlaceMargin() bytes longer than the
+//   decompressed length. Returns the inflated content. Frames are inflated in order on the
+//   calling thread, since each overwrites the image of those before it.
+std::span<std::byte> inflateInPlace(std::span<std::byte> buffer, uint64_t compressedLength) {
+  if(compressedLength > buffer.size()) {
+    throw std::runtime_error("Compressed length exceeds the in place buffer.");
+  }
+  auto image = buffer.last((size_t)compressedLength);
+  auto frames = readFrames(image);
+  uint64_t length = totalDecompressedLength(frames);
+  if(buffer.size() < length || buffer.size() - compressedLength < inPlaceLead(image, frames)) {
+    throw std::runtime_error("Buffer is too short to inflate in place.");
+  }
 
-  auto outIter = outView.begin();
+  auto out = buffer.first((size_t)length);
+  inflateFrames(frames, out, false);
+  return out;
+}
 
-  //~~@ thread this
-  for(auto& node : table) {
-    auto inTail = inIter + node.prefix;
-    outIter = std::copy(inIter, inTail, outIter);
-    inIter = inTail;
+// Inflates the RLE image in data in place, growing data only by the margin it needs.
+void inflateInPlace(std::vector<std::byte>& data) {
+  uint64_t compressedLength = data.size();
+  uint64_t length = totalDecompressedLength(readFrames(data));
+  data.resize((size_t)(length + inflateInPlaceMargin(data)));
+  std::memmove(data.data() + data.size() - compressedLength, data.data(), (size_t)compressedLength);
+  inflateInPlace(data, compressedLength);
+  data.resize((size_t)length);
+}
+
+// Inflates every job's input into its output, scheduling all frames of all inputs as one
+//   stream of work on the shared pool. Jobs are mapped a batch at a time, so the number of
+//   files open at once stays bounded.
+void inflateBatch(const std::vector<BatchJob>& jobs, const CancellationToken& cancellation = {}) {
+  constexpr size_t BATCH_SIZE = 1024;
+
+  for(size_t first = 0; first < jobs.size(); first += BATCH_SIZE) {
+    size_t count = std::min(BATCH_SIZE, jobs.size() - first);
+    std::span<const BatchJob> batch(jobs.data() + first, count);
+
+    MappedInputs inputs(jobInputs(batch));
+    std::vector<std::vector<RLEFrame>> frames(count);
+    std::vector<uint64_t> lengths(count);
+    for(size_t i = 0; i < count; i++) {
+      frames[i] = readFrames(inputs.spans[i]);
+      lengths[i] = totalDecompressedLength(frames[i]);
+    }
+    MappedOutputs outputs(batch, lengths);
 
-    auto outTail = outIter + node.length;
-    std::fill(outIter, outTail, node.value);
-    outIter = outTail;
+    struct Item {
+      const RLEFrame* frame;
+      std::span<std::byte> out;
+    };
+    std::vector<Item> items;
+    for(size_t i = 0; i < count; i++) {
+      uint64_t offset = 0;
+      for(auto& frame : frames[i]) {
+        items.push_back({ &frame, outputs.spans[i].subspan((size_t)offset, (size_t)frame.decompressedLength()) });
+        offset += frame.decompressedLength();
+      }
+    }
+
+    parallelFor(items.size(), [&](size_t k) {
+      cancellation.throwIfCancelled();
+      inflateFrame(*items[k].frame, items[k].out);
+    });
+    outputs.commit();
   }
+}
 
-  outIter = std::copy(inIter, inView.end(), outIter);
-  if(outIter != outView.end()) {
-    throw std::runtime_error("Inflated file does not match expected length.");
+// Computes the CRC32C of the data that an RLE image would inflate to, without inflating it.
+// Literals are hashed as they sit in the image and runs are applied in closed form, so the
+//   cost is proportional to the compressed size rather than the decompressed size, except
+//   for back references, which are expanded, and entropy coded literals, which are decoded.
+uint32_t checksumDeflated(std::span<const std::byte> rleData) {
+  uint32_t crc = ~0u;
+  std::vector<std::byte> decoded;
+  for(auto& frame : readFrames(rleData)) {
+    if(frame.header->hasFlag(FrameFlag::MATCHES)) { // back references have to be expanded to be hashed
+      walkFrame(frame, FrameIndex(frame), 0, frame.decompressedLength(),
+        [&](std::span<const std::byte> literals) { crc = crc32cUpdate(crc, literals); },
+        [&](std::byte value, uint64_t length) { crc = crc32cUpdate(crc, value, length); });
+      continue;
+    }
+
+    auto literals = frameLiterals(frame, decoded);
+    for(auto& run : frame.runs) {
+      crc = crc32cUpdate(crc, literals.first((size_t)run.prefix));
+      literals = literals.subspan((size_t)run.prefix);
+      crc = crc32cUpdate(crc, run.value, run.length);
+    }
+    crc = crc32cUpdate(crc, literals);
   }
+  return ~crc;
 }
 
+uint32_t checksumDeflatedFile(const std::string& rleFilename) {
+  MappedFile inMap(rleFilename, MappedFile::CreationDisposition::OPEN);
+  auto inView = inMap.getView(0, inMap.size());
+  return checksumDeflated(inView);
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include "RLE_Inflate.h"
+#include "LazyRegion.h"
+#include <cstring>
+
+// class LazyInflatedMapping
+// Presents the inflated content of an RLE file as a read-only region of memory without
+//   inflating it up front. Address space for the whole content is reserved at once, and
+//   each block is inflated from the seek index of its frame when it is first touched, so
+//   opening is immediate and memory is only spent on blocks which are read. Pages start
+//   zeroed, so runs of zero are never written at all. An entropy coded literal section is
+//   decoded in full when its frame is first touched, and kept for later blocks of the frame.
+// Frame checksums are not verified, since a block seldom covers a whole frame. Use
+//   verifyDeflated() or checksumDeflated() beforehand when that matters.
+class LazyInflatedMapping {
+public:
+  explicit LazyInflatedMapping(const std::string& rleFilename, uint64_t blockSize = 1 << 16) :
+    map(rleFilename, MappedFile::CreationDisposition::OPEN),
+    view(map.getView(0, map.size())),
+    frames(readFrames(view)),
+    decodeOnce(std::make_unique<std::once_flag[]>(frames.size()))
+  {
+    indices.reserve(frames.size());
+    uint64_t offset = 0;
+    for(auto& frame : frames) {
+      indices.emplace_back(frame);
+      frameOffsets.push_back(offset);
+      offset += frame.decompressedLength();
+    }
+    frameOffsets.push_back(offset);
+
+    if(offset != 0) {
+      region = std::make_unique<LazyRegion>(offset, blockSize, [this](uint64_t blockOffset, std::span<std::byte> block) {
+        fill(blockOffset, block);
+      });
+    }
+  }
+
+  std::span<const std::byte> data() const { return region ? region->data() : std::span<const std::byte>(); }
+  uint64_t size() const { return frameOffsets.back(); }
+
+private:
+  void fill(uint64_t offset, std::span<std::byte> block) {
+    auto out = block.data();
+    uint64_t end = offset + block.size();
+    auto first = std::upper_bound(frameOffsets.begin(), frameOffsets.end(), offset) - frameOffsets.begin() - 1;
+    for(size_t i = (size_t)first; i < frames.size() && frameOffsets[i] < end; i++) {
+      uint64_t begin = std::max(offset, frameOffsets[i]) - frameOffsets[i];
+      uint64_t stop = std::min(end, frameOffsets[i + 1]) - frameOffsets[i];
+      auto onLiterals = [&](std::span<const std::byte> literals) {
+        std::memcpy(out, literals.data(), literals.size());
+        out += literals.size();
+      };
+      auto onRun = [&](std::byte value, uint64_t length) {
+        if(value != std::byte{ 0 }) {
+          std::memset(out, (int)value, (size_t)length);
+        }
+        out += length;
+      };
+      std::call_once(decodeOnce[i], [&] {
+        if(!frames[i].codedLiterals.empty()) { decodeFrameLiterals(frames[i]); }
+      });
+      walkFrame(frames[i], indices[i], begin, stop, onLiterals, onRun);
+    }
+  }
+
+  MappedFile map;
+  MappedFile::View view;
+  std::vector<RLEFrame> frames;
+  std::unique_ptr<std::once_flag[]> decodeOnce; // one per frame, for its coded literals
+  std::vector<FrameIndex> indices;
+  std::vector<uint64_t> frameOffsets; // decompressed offset of each frame, plus the total length
+  std::unique_ptr<LazyRegion> region;
+
+};
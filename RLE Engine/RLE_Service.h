@@ -0,0 +1,208 @@
+#pragma once
+#include "RLE_Inflate.h"
+#include "RLE_Deflate.h"
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <sstream>
+
+// A long running compression service. Requests from any number of clients share one warm
+//   worker pool and its chunk arenas, so no client pays for thread creation or allocation
+//   warm-up. Payloads are passed as files which the service maps directly, so nothing is
+//   copied between processes beyond the pages the OS already shares.
+
+enum class ServiceOperation {
+  DEFLATE,
+  INFLATE
+};
+
+struct ServiceRequest {
+  ServiceOperation operation = ServiceOperation::DEFLATE;
+  std::string inputFilename;
+  std::string outputFilename;
+  int priority = 0; // higher priorities are started first
+  DeflateOptions options;
+};
+
+struct ServiceMetrics {
+  uint64_t completed = 0;
+  uint64_t failed = 0;
+  uint64_t queued = 0;
+  uint64_t bytesIn = 0;
+  uint64_t bytesOut = 0;
+  double totalLatency = 0; // seconds from submission to completion, summed over requests
+  double maxLatency = 0;
+  double uptime = 0;
+};
+
+// class CompressionService
+// Queues requests by priority, first come first served within a priority, and runs up to
+//   concurrency of them at once. Each request spreads over the shared pool as usual.
+class CompressionService {
+public:
+  explicit CompressionService(size_t concurrency = 2) :
+    started(std::chrono::steady_clock::now())
+  {
+    for(size_t i = 0; i < std::max<size_t>(concurrency, 1); i++) {
+      dispatchers.emplace_back([this] { dispatch(); });
+    }
+  }
+
+  CompressionService(const CompressionService&) = delete;
+  CompressionService& operator=(const CompressionService&) = delete;
+
+  // Requests already queued are completed before the service stops.
+  ~CompressionService() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+    for(auto& thread : dispatchers) {
+      thread.join();
+    }
+  }
+
+  std::future<void> submit(ServiceRequest request) {
+    auto pending = std::make_unique<Pending>();
+    pending->request = std::move(request);
+    pending->submitted = std::chrono::steady_clock::now();
+    auto result = pending->done.get_future();
+    {
+      std::lock_guard lock(mutex);
+      pending->sequence = nextSequence++;
+      queue.push_back(std::move(pending));
+      std::push_heap(queue.begin(), queue.end(), runsLater);
+    }
+    ready.notify_one();
+    return result;
+  }
+
+  ServiceMetrics metrics() const {
+    std::lock_guard lock(mutex);
+    ServiceMetrics snapshot = totals;
+    snapshot.queued = queue.size();
+    snapshot.uptime = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return snapshot;
+  }
+
+  // Serves one line of the text protocol used over serveNamedPipe(). Fields are separated by
+  //   tabs, since paths may hold spaces:
+  //     deflate|inflate [priority] [input file] [output file]  ->  ok, or error [message]
+  //     metrics                                                 ->  key=value pairs
+  std::string handle(const std::string& line) {
+    std::vector<std::string> fields;
+    std::istringstream stream(line);
+    for(std::string field; std::getline(stream, field, '\t'); ) {
+      fields.push_back(field);
+    }
+
+    try {
+      if(fields.size() == 1 && fields[0] == "metrics") {
+        auto m = metrics();
+        std::ostringstream out;
+        out << "completed=" << m.completed << " failed=" << m.failed << " queued=" << m.queued
+            << " bytesIn=" << m.bytesIn << " bytesOut=" << m.bytesOut
+            << " meanLatency=" << (m.completed + m.failed ? m.totalLatency / (double)(m.completed + m.failed) : 0.0)
+            << " maxLatency=" << m.maxLatency
+            << " throughput=" << (m.uptime > 0 ? (double)m.bytesIn / (1 << 20) / m.uptime : 0.0);
+        return out.str();
+      }
+
+      if(fields.size() == 4 && (fields[0] == "deflate" || fields[0] == "inflate")) {
+        ServiceRequest request;
+        request.operation = fields[0] == "deflate" ? ServiceOperation::DEFLATE : ServiceOperation::INFLATE;
+        request.priority = std::stoi(fields[1]);
+        request.inputFilename = fields[2];
+        request.outputFilename = fields[3];
+        submit(std::move(request)).get();
+        return "ok";
+      }
+
+      return "error Unrecognised request.";
+    }
+    catch(const std::exception& e) {
+      return std::string("error ") + e.what();
+    }
+  }
+
+private:
+  struct Pending {
+    ServiceRequest request;
+    uint64_t sequence = 0;
+    std::chrono::steady_clock::time_point submitted;
+    std::promise<void> done;
+  };
+
+  // Heap order: the front of the queue is the highest priority, then the oldest request.
+  static bool runsLater(const std::unique_ptr<Pending>& a, const std::unique_ptr<Pending>& b) {
+    if(a->request.priority != b->request.priority) {
+      return a->request.priority < b->request.priority;
+    }
+    return a->sequence > b->sequence;
+  }
+
+  void dispatch() {
+    while(true) {
+      std::unique_ptr<Pending> pending;
+      {
+        std::unique_lock lock(mutex);
+        ready.wait(lock, [this] { return stopping || !queue.empty(); });
+        if(queue.empty()) { return; }
+        std::pop_heap(queue.begin(), queue.end(), runsLater);
+        pending = std::move(queue.back());
+        queue.pop_back();
+      }
+      run(*pending);
+    }
+  }
+
+  void run(Pending& pending) {
+    auto& request = pending.request;
+    std::exception_ptr error;
+    uint64_t bytesIn = 0;
+    uint64_t bytesOut = 0;
+    try {
+      if(request.operation == ServiceOperation::DEFLATE) {
+        deflateFile(request.inputFilename, request.outputFilename, request.options);
+      }
+      else {
+        inflateFile(request.inputFilename, request.outputFilename, request.options.cancellation);
+      }
+      bytesIn = std::filesystem::file_size(request.inputFilename);
+      bytesOut = std::filesystem::file_size(request.outputFilename);
+    }
+    catch(...) {
+      error = std::current_exception();
+    }
+
+    // Metrics are recorded before the client is released, so they already include its request.
+    double latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - pending.submitted).count();
+    {
+      std::lock_guard lock(mutex);
+      (error ? totals.failed : totals.completed)++;
+      totals.bytesIn += bytesIn;
+      totals.bytesOut += bytesOut;
+      totals.totalLatency += latency;
+      totals.maxLatency = std::max(totals.maxLatency, latency);
+    }
+
+    if(error) {
+      pending.done.set_exception(error);
+    }
+    else {
+      pending.done.set_value();
+    }
+  }
+
+  mutable std::mutex mutex;
+  std::condition_variable ready;
+  std::vector<std::unique_ptr<Pending>> queue; // a heap ordered by runsLater
+  uint64_t nextSequence = 0;
+  bool stopping = false;
+  ServiceMetrics totals;
+  std::chrono::steady_clock::time_point started;
+  std::vector<std::thread> dispatchers;
+
+};
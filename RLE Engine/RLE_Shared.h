@@ -1,14 +1,39 @@
 #pragma once
+#include <array>
+#include <cstring>
 #include <limits>
 #include <stdexcept>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <span>
+#include <vector>
 #include "MappedFile.h"
 
 struct Run {
   uint64_t prefix; //number of preceeding non-run bytes
   uint64_t length;
   std::byte value;
+  uint32_t distance = 0; //for a back reference, how far back the bytes it repeats begin; zero for a run of value
 };
 
+// Back references copy from at most MATCH_WINDOW bytes back. They neither copy from before,
+//   nor extend past, a multiple of MATCH_RESTART_INTERVAL within their frame, so content can
+//   be decoded from any such multiple without what precedes it.
+constexpr uint64_t MATCH_WINDOW = std::numeric_limits<uint8_t>::max();
+constexpr uint64_t MATCH_RESTART_INTERVAL = 1 << 16;
+
+// Whether a back reference of length bytes at offset within its frame keeps to its restart interval.
+bool matchWithinRestart(uint64_t offset, uint64_t length, uint64_t distance) {
+  uint64_t restart = offset / MATCH_RESTART_INTERVAL * MATCH_RESTART_INTERVAL;
+  return distance != 0 && distance <= MATCH_WINDOW && distance <= offset - restart && length <= restart + MATCH_RESTART_INTERVAL - offset;
+}
+
 template<class T>
 constexpr size_t bitsizeof(T = T{}) {
   constexpr size_t BITS_PER_BYTE = 8;
@@ -22,6 +47,9 @@ struct PackedNode {
   static constexpr size_t PrefixMax = std::numeric_limits<PrefixType>::max();
   using LengthType = LengthT;
   static constexpr size_t LengthMax = std::numeric_limits<LengthType>::max();
+  // Standard nodes are never this short, so repeat nodes take these lengths as group sizes.
+  static constexpr size_t RepeatGroupMax = sizeof(PrefixT) + sizeof(LengthT) + sizeof(std::byte);
+  static constexpr uint64_t RepeatCountMax = PrefixMax | ((uint64_t)std::numeric_limits<uint8_t>::max() << bitsizeof<PrefixType>());
 
   PrefixT prefix;
   LengthT length;
@@ -95,6 +123,25 @@ struct PackedNode {
     uint64_t hiBits = ((uint64_t)value) << bitsizeof<PrefixType>();
     return loBits | hiBits;
   }
+
+  void beRepeatNode(size_t groupSize, uint64_t count) {
+    if(groupSize == 0 || groupSize > RepeatGroupMax || count == 0 || count > RepeatCountMax) {
+      throw std::runtime_error("Tried to make a repeat node out of range.");
+    }
+    set((PrefixType)(count & PrefixMax), (LengthType)groupSize, (std::byte)(count >> bitsizeof<PrefixType>()));
+  }
+
+  uint64_t getRepeatCount() const {
+    return getSkipLength();
+  }
+
+  // Follows a signal node, like a long node, but with a prefix of zero, which no long node has.
+  void beMatchNode(LengthType matchLength, uint64_t distance) {
+    if(matchLength == 0 || distance == 0 || distance > MATCH_WINDOW) {
+      throw std::runtime_error("Tried to make a match node out of range.");
+    }
+    set(0, matchLength, (std::byte)distance);
+  }
 };
 #pragma pack(pop)
 
@@ -111,6 +158,21 @@ enum class NodeFormat {
   INEFFICIENT
 };
 
+// Frame flags share the format byte with NodeFormat, using bits that no format value occupies.
+enum class FrameFlag : uint8_t {
+  CHECKSUM = 0x80, // frame is followed by a FrameChecksum record
+  REPEATS  = 0x40, // node table may hold repeat nodes
+  MATCHES  = 0x08, // node table may hold back references
+  CODED_LITERALS = 0x04, // literal section is entropy coded, and starts with a LiteralCodeHeader
+};
+
+constexpr uint8_t NODE_FORMAT_MASK = 0x33;
+
+// An RLE file is one or more frames laid end to end. Each frame is a Header, its node table
+//   and its literal section, and inflates independently of the others. The literal section
+//   length is implied by decompressedLength less the run lengths in the table, so frames
+//   need no explicit compressed length. An entropy coded literal section gives its own
+//   length in its header.
 #pragma pack(push, 1)
 struct Header {
   char magic[4] = "RLE";
@@ -121,13 +183,466 @@ struct Header {
     magic[3] = (char)format;
   }
 
+  void setFlag(FrameFlag flag) {
+    magic[3] = (char)((uint8_t)magic[3] | (uint8_t)flag);
+  }
+
+  void setFlags(uint8_t flags) {
+    magic[3] = (char)((uint8_t)magic[3] | flags);
+  }
+
+  bool hasFlag(FrameFlag flag) const {
+    return ((uint8_t)magic[3] & (uint8_t)flag) != 0;
+  }
+
+  uint8_t flags() const {
+    return (uint8_t)magic[3] & (uint8_t)~NODE_FORMAT_MASK;
+  }
+
   NodeFormat checkMagic() const {
     static const std::string EXPECT = "RLE";
     if(!std::equal(EXPECT.begin(), EXPECT.end(), std::span(magic).begin())) {
       throw std::runtime_error("Attempted to reinflate a non RLE file.");
     }
-    return (NodeFormat)magic[3];
+    return (NodeFormat)((uint8_t)magic[3] & NODE_FORMAT_MASK);
   }
 };
+
+// Trailing record of a frame which has FrameFlag::CHECKSUM set. Both values are CRC32C.
+struct FrameChecksum {
+  uint32_t compressed;   // header, node table and literal section of the frame, as stored
+  uint32_t decompressed; // inflated content of the frame
+};
 #pragma pack(pop)
 
+// Decodes a node table, passing each run it encodes to onRun(run) in order. Besides standard,
+//   skip and signal/long nodes, a table may hold the kinds its frame flags allow:
+//   REPEATS: repeat nodes, whose length (1 to RepeatGroupMax) is a number of runs and whose
+//            prefix and value hold a count: the group of that many runs just decoded recurs
+//            count more times. Periodic data thereby needs one node for any number of
+//            identical records.
+//   MATCHES: match nodes, which follow a signal node in place of a long node and carry the
+//            length and distance of a back reference.
+// Throws if the table ends within a long node, a repeat node does not follow whole runs, or
+//   the runs would cover more than decompressedLength bytes. The last is checked before a
+//   repeat node is expanded, so a small table cannot make the caller decode a huge one.
+template <class NodeType, class RunFunc>
+void decodeNodes(std::span<const NodeType> nodes, uint8_t flags, uint64_t decompressedLength, RunFunc&& onRun) {
+  bool repeats = (flags & (uint8_t)FrameFlag::REPEATS) != 0;
+  bool matches = (flags & (uint8_t)FrameFlag::MATCHES) != 0;
+
+  std::array<Run, NodeType::RepeatGroupMax> recent; // the last runs decoded, as a ring
+  uint64_t decoded = 0;
+  uint64_t covered = 0; // bytes of prefix and run the emitted runs span
+  auto emit = [&](const Run& run) {
+    if(run.prefix > decompressedLength - covered || run.length > decompressedLength - covered - run.prefix) {
+      throw std::runtime_error("RLE node table does not match expected length.");
+    }
+    covered += run.prefix + run.length;
+    recent[decoded++ % recent.size()] = run;
+    onRun(run);
+  };
+
+  Run run{};
+  for(auto iter = nodes.begin(); iter != nodes.end(); iter++) {
+    if(iter->length == 0) {
+      if(iter->value == (std::byte)0) { //signal&long node
+        run.prefix += iter->prefix;
+        if(++iter == nodes.end()) {
+          throw std::runtime_error("RLE node table ends within a long node.");
+        }
+        if(matches && iter->prefix == 0) { //match node
+          run.length = iter->length;
+          run.distance = (uint32_t)iter->value;
+        }
+        else {
+          run.length = iter->getLongLength();
+          run.value = iter->value;
+        }
+        emit(run);
+        run = Run{};
+        continue;
+      }
+      else { //skip node
+        run.prefix += iter->getSkipLength();
+        continue;
+      }
+    }
+
+    if(repeats && iter->length <= NodeType::RepeatGroupMax) { //repeat node
+      uint64_t group = iter->length;
+      if(run.prefix != 0 || group > decoded) {
+        throw std::runtime_error("RLE repeat node does not follow whole runs.");
+      }
+      uint64_t groupBytes = 0;
+      for(uint64_t i = decoded - group; i < decoded; i++) {
+        groupBytes += recent[i % recent.size()].prefix + recent[i % recent.size()].length;
+      }
+      if(groupBytes == 0 || iter->getRepeatCount() > (decompressedLength - covered) / groupBytes) {
+        throw std::runtime_error("RLE node table does not match expected length.");
+      }
+      for(uint64_t i = 0, count = group * iter->getRepeatCount(); i < count; i++) {
+        emit(recent[(decoded - group) % recent.size()]);
+      }
+      continue;
+    }
+
+    //standard
+    run.prefix += iter->prefix;
+    run.length = iter->length;
+    run.value = iter->value;
+    emit(run);
+    run = Run{};
+  }
+}
+
+// class WorkerPool
+// A fixed set of worker threads which every parallel operation in the engine shares, so
+//   threads are started once per process rather than once per call and back-to-back jobs
+//   keep the same workers busy. Tasks are run in submission order.
+class WorkerPool {
+public:
+  static WorkerPool& shared() {
+    static WorkerPool pool(sharedThreadCount());
+    return pool;
+  }
+
+  // Sets how many threads the shared pool starts. This has no effect once the pool is in use.
+  static void configureShared(size_t threadCount) {
+    sharedThreadCount() = std::max<size_t>(threadCount, 1);
+  }
+
+  explicit WorkerPool(size_t threadCount) {
+    threads.reserve(threadCount);
+    for(size_t i = 0; i < threadCount; i++) {
+      threads.emplace_back([this] { run(); });
+    }
+  }
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  ~WorkerPool() {
+    {
+      std::lock_guard lock(mutex);
+      stopping = true;
+    }
+    ready.notify_all();
+    for(auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  size_t size() const { return threads.size(); }
+
+  // Tasks must not throw.
+  void submit(std::function<void()> task) {
+    {
+      std::lock_guard lock(mutex);
+      tasks.push_back(std::move(task));
+    }
+    ready.notify_one();
+  }
+
+private:
+  static size_t& sharedThreadCount() {
+    static size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    return threadCount;
+  }
+
+  void run() {
+    while(true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex);
+        ready.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if(tasks.empty()) { return; }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::deque<std::function<void()>> tasks;
+  bool stopping = false;
+  std::vector<std::thread> threads;
+
+};
+
+// Runs body(i) for every i in [0, count) on the shared WorkerPool, on at most maxWorkers
+//   threads at once. The calling thread takes part and only waits for items to finish, never
+//   for a helper to start, so parallelFor may be nested inside another parallelFor without
+//   starving the pool. Once an item throws, no further items are started and the first
+//   exception is rethrown here.
+template <class Func>
+void parallelFor(size_t count, Func&& body, size_t maxWorkers = std::numeric_limits<size_t>::max()) {
+  if(count == 0) { return; }
+
+  // Helpers can be dequeued after this call has returned, so they hold the state by
+  //   shared_ptr and only touch body after claiming an item.
+  struct State {
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> finished = 0;
+    std::atomic<bool> failed = false;
+    size_t count = 0;
+    std::function<void(size_t)> body;
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::condition_variable done;
+  };
+  auto state = std::make_shared<State>();
+  state->count = count;
+  state->body = [&body](size_t i) { body(i); };
+
+  auto work = [state] {
+    for(size_t i = state->next++; i < state->count; i = state->next++) {
+      if(!state->failed) {
+        try {
+          state->body(i);
+        }
+        catch(...) {
+          std::lock_guard lock(state->mutex);
+          if(!state->error) { state->error = std::current_exception(); }
+          state->failed = true;
+        }
+      }
+      if(++state->finished == state->count) {
+        std::lock_guard lock(state->mutex);
+        state->done.notify_all();
+      }
+    }
+  };
+
+  auto& pool = WorkerPool::shared();
+  size_t helperCount = std::min({ count, pool.size() + 1, std::max<size_t>(maxWorkers, 1) }) - 1;
+  for(size_t i = 0; i < helperCount; i++) {
+    pool.submit(work);
+  }
+  work();
+
+  std::unique_lock lock(state->mutex);
+  state->done.wait(lock, [&] { return state->finished == state->count; });
+  if(state->error) {
+    std::rethrow_exception(state->error);
+  }
+}
+
+class OperationCancelled : public std::runtime_error {
+public:
+  OperationCancelled() : std::runtime_error("Operation was cancelled.") {}
+};
+
+// class CancellationToken
+// Lets one thread ask a long operation running elsewhere to stop. Copies share their state,
+//   so the caller keeps one copy and hands another to the operation, which checks it between
+//   blocks of work, and within one every CANCELLATION_CHECK_BYTES of input or
+//   CANCELLATION_CHECK_RUNS runs. A default constructed token can never be cancelled.
+class CancellationToken {
+public:
+  static CancellationToken create() {
+    CancellationToken token;
+    token.flag = std::make_shared<std::atomic<bool>>(false);
+    return token;
+  }
+
+  void cancel() const {
+    if(flag) { *flag = true; }
+  }
+
+  bool cancelled() const { return flag && *flag; }
+
+  void throwIfCancelled() const {
+    if(cancelled()) { throw OperationCancelled(); }
+  }
+
+private:
+  std::shared_ptr<std::atomic<bool>> flag;
+
+};
+
+constexpr uint64_t CANCELLATION_CHECK_BYTES = 1 << 20;
+constexpr size_t CANCELLATION_CHECK_RUNS = 1 << 16;
+
+// Scatter-gather data is a list of discontiguous spans treated as one logical stream, in the
+//   manner of an iovec.
+template <class Byte>
+uint64_t segmentsLength(std::span<const std::span<Byte>> segments) {
+  uint64_t length = 0;
+  for(auto& segment : segments) {
+    length += segment.size();
+  }
+  return length;
+}
+
+// Copies [offset, offset + out.size()) of the stream to out.
+template <class Byte>
+void readSegments(std::span<const std::span<Byte>> segments, uint64_t offset, std::span<std::byte> out) {
+  for(auto& segment : segments) {
+    if(out.empty()) { break; }
+    if(offset >= segment.size()) {
+      offset -= segment.size();
+      continue;
+    }
+    size_t length = (size_t)std::min<uint64_t>(out.size(), segment.size() - offset);
+    std::memcpy(out.data(), segment.data() + offset, length);
+    out = out.subspan(length);
+    offset = 0;
+  }
+}
+
+// Returns the pieces of segments which cover [offset, offset + length) of the stream.
+template <class Byte>
+std::vector<std::span<Byte>> sliceSegments(std::span<const std::span<Byte>> segments, uint64_t offset, uint64_t length) {
+  std::vector<std::span<Byte>> pieces;
+  for(auto& segment : segments) {
+    if(length == 0) { break; }
+    if(offset >= segment.size()) {
+      offset -= segment.size();
+      continue;
+    }
+    auto piece = segment.subspan((size_t)offset, (size_t)std::min<uint64_t>(length, segment.size() - offset));
+    pieces.push_back(piece);
+    length -= piece.size();
+    offset = 0;
+  }
+  return pieces;
+}
+
+// class SegmentCursor
+// Walks a list of segments as one stream. Each step hands its bytes to a callback as one
+//   contiguous piece per segment it touches. Steps must not run past the end of the stream.
+template <class Byte>
+class SegmentCursor {
+public:
+  explicit SegmentCursor(std::span<const std::span<Byte>> segments) :
+    segments(segments),
+    left(segmentsLength(segments))
+  {
+    settle();
+  }
+
+  uint64_t remaining() const { return left; }
+
+  Byte& current() const { return segments[index][(size_t)offset]; }
+
+  template <class PieceFunc>
+  void advance(uint64_t count, PieceFunc&& onPiece) {
+    left -= count;
+    while(count > 0) {
+      auto piece = segments[index].subspan((size_t)offset, (size_t)std::min<uint64_t>(count, segments[index].size() - offset));
+      onPiece(piece);
+      offset += piece.size();
+      count -= piece.size();
+      settle();
+    }
+  }
+
+private:
+  // Moves past the end of the current segment and any empty ones.
+  void settle() {
+    while(index < segments.size() && offset == segments[index].size()) {
+      index++;
+      offset = 0;
+    }
+  }
+
+  std::span<const std::span<Byte>> segments;
+  size_t index = 0;
+  uint64_t offset = 0;
+  uint64_t left;
+
+};
+
+struct BatchJob {
+  std::string inputFilename;
+  std::string outputFilename;
+};
+
+std::vector<std::string> jobInputs(std::span<const BatchJob> jobs) {
+  std::vector<std::string> filenames;
+  filenames.reserve(jobs.size());
+  for(auto& job : jobs) {
+    filenames.push_back(job.inputFilename);
+  }
+  return filenames;
+}
+
+// struct MappedInputs
+// Maps a set of files for reading and holds each one's content as a span.
+struct MappedInputs {
+  explicit MappedInputs(std::span<const std::string> filenames) :
+    spans(filenames.size())
+  {
+    maps.reserve(filenames.size());
+    views.reserve(filenames.size());
+    for(size_t i = 0; i < filenames.size(); i++) {
+      auto& map = maps.emplace_back(filenames[i], MappedFile::CreationDisposition::OPEN);
+      spans[i] = views.emplace_back(map.getView(0, map.size()));
+    }
+  }
+
+  std::vector<MappedFile> maps;
+  std::vector<MappedFile::View> views;
+  std::vector<std::span<const std::byte>> spans;
+};
+
+// class OutputCleanup
+// Removes an output file on destruction unless commit() has been called, so an operation which
+//   throws partway through does not leave a partial output behind. The file is only removed
+//   once created() has been called, so an output which already existed is never touched.
+//   Declare it ahead of the output's MappedFile, so the mapping is released first.
+class OutputCleanup {
+public:
+  explicit OutputCleanup(std::string filename) : filename(std::move(filename)) {}
+  OutputCleanup(const OutputCleanup&) = delete;
+
+  ~OutputCleanup() {
+    if(owned && !committed) {
+      std::error_code ignored;
+      std::filesystem::remove(filename, ignored);
+    }
+  }
+
+  void created() { owned = true; }
+  void commit() { committed = true; }
+
+private:
+  std::string filename;
+  bool owned = false;
+  bool committed = false;
+
+};
+
+// struct MappedOutputs
+// Creates and maps the output file of each job at the given length and holds each one's
+//   view as a span. Outputs of length zero are created empty and get empty spans. The files
+//   are removed again on destruction unless commit() has been called.
+struct MappedOutputs {
+  MappedOutputs(std::span<const BatchJob> jobs, std::span<const uint64_t> lengths) :
+    spans(jobs.size())
+  {
+    maps.reserve(jobs.size());
+    views.reserve(jobs.size());
+    for(size_t i = 0; i < jobs.size(); i++) {
+      auto& cleanup = cleanups.emplace_back(jobs[i].outputFilename);
+      auto& map = maps.emplace_back(jobs[i].outputFilename, MappedFile::CreationDisposition::CREATE, lengths[i]);
+      cleanup.created();
+      if(lengths[i] == 0) { continue; }
+      spans[i] = views.emplace_back(map.getView(0, map.size()));
+    }
+  }
+
+  void commit() {
+    for(auto& cleanup : cleanups) {
+      cleanup.commit();
+    }
+  }
+
+  std::deque<OutputCleanup> cleanups; // first, so the maps and views are released before it
+  std::vector<MappedFile> maps;
+  std::vector<MappedFile::View> views;
+  std::vector<std::span<std::byte>> spans;
+};
@@ -0,0 +1,200 @@
+#pragma once
+#include "RLE_Deflate.h"
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <optional>
+#include <string>
+
+// The best block size, node format and thread count depend on both the data and the host, so
+//   they are found by measurement. autotune() deflates a sample of the corpus under candidate
+//   settings and keeps those best for the chosen objective, which are saved as a profile for
+//   the compressor to load.
+
+std::string formatName(NodeFormat format) {
+  switch(format) {
+  case NodeFormat::P8L8:   return "P8L8";
+  case NodeFormat::P8L16:  return "P8L16";
+  case NodeFormat::P16L8:  return "P16L8";
+  case NodeFormat::P16L16: return "P16L16";
+  default: return "auto";
+  }
+}
+
+NodeFormat parseFormatName(const std::string& name) {
+  for(auto format : { NodeFormat::P8L8, NodeFormat::P8L16, NodeFormat::P16L8, NodeFormat::P16L16 }) {
+    if(name == formatName(format)) { return format; }
+  }
+  if(name == "auto") { return NodeFormat::INEFFICIENT; }
+  throw std::runtime_error("Unrecognized RLE node format name: " + name);
+}
+
+std::string levelName(CompressionLevel level) {
+  switch(level) {
+  case CompressionLevel::FASTEST: return "fastest";
+  case CompressionLevel::DEFAULT: return "default";
+  case CompressionLevel::STRONG:  return "strong";
+  case CompressionLevel::MAX:     return "max";
+  }
+  throw std::logic_error("Failed to switch by level.");
+}
+
+CompressionLevel parseLevelName(const std::string& name) {
+  for(auto level : { CompressionLevel::FASTEST, CompressionLevel::DEFAULT, CompressionLevel::STRONG, CompressionLevel::MAX }) {
+    if(name == levelName(level)) { return level; }
+  }
+  throw std::runtime_error("Unrecognized compression level: " + name);
+}
+
+// A profile is a text file of key=value lines. Lines starting with # are comments.
+void saveProfile(const std::string& filename, const DeflateOptions& options, const std::string& comment = {}) {
+  std::ofstream out(filename, std::ios::trunc);
+  if(!comment.empty()) {
+    out << "# " << comment << "\n";
+  }
+  out << "blockSize=" << options.blockSize << "\n";
+  out << "format=" << formatName(options.format) << "\n";
+  out << "level=" << levelName(options.level) << "\n";
+  out << "threads=" << options.threads << "\n";
+  out << "checksums=" << (options.checksums ? 1 : 0) << "\n";
+  if(!out) {
+    throw std::runtime_error("Failed to write profile " + filename);
+  }
+}
+
+// Settings missing from the profile keep their defaults.
+DeflateOptions loadProfile(const std::string& filename) {
+  std::ifstream in(filename);
+  if(!in) {
+    throw std::runtime_error("Failed to read profile " + filename);
+  }
+
+  DeflateOptions options;
+  for(std::string line; std::getline(in, line); ) {
+    auto split = line.find('=');
+    if(line.starts_with("#") || split == std::string::npos) { continue; }
+    auto key = line.substr(0, split);
+    auto value = line.substr(split + 1);
+    if(key == "blockSize")      { options.blockSize = std::stoull(value); }
+    else if(key == "format")    { options.format = parseFormatName(value); }
+    else if(key == "level")     { options.level = parseLevelName(value); }
+    else if(key == "threads")   { options.threads = (size_t)std::stoull(value); }
+    else if(key == "checksums") { options.checksums = value == "1"; }
+  }
+  return options;
+}
+
+enum class TuneObjective {
+  THROUGHPUT, // fastest
+  SIZE,       // smallest output
+  THROUGHPUT_AT_RATIO // fastest of those reaching a least ratio
+};
+
+struct TuneTrial {
+  DeflateOptions options;
+  double throughput = 0; // MiB of input deflated per second
+  double ratio = 0;      // input length over output length
+};
+
+// Deflates samples under options repeatedly for a short while and measures the outcome.
+TuneTrial measureTrial(std::span<const std::span<const std::byte>> samples, const DeflateOptions& options) {
+  constexpr double MIN_SECONDS = 0.25;
+
+  TuneTrial trial{ options };
+  uint64_t inLength = segmentsLength(samples);
+  uint64_t outLength = 0;
+  size_t repeats = 0;
+  auto start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    auto deflated = deflateBatch(samples, options);
+    if(repeats++ == 0) {
+      for(auto& output : deflated) {
+        outLength += output.size();
+      }
+    }
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while(elapsed.count() < MIN_SECONDS);
+
+  trial.throughput = (double)(inLength * repeats) / (1 << 20) / elapsed.count();
+  trial.ratio = outLength == 0 ? 0 : (double)inLength / (double)outLength;
+  return trial;
+}
+
+// Returns whether a serves objective better than b. Under THROUGHPUT_AT_RATIO, trials which
+//   miss minRatio only compete on ratio, so the closest is kept if none reach it.
+bool betterTrial(const TuneTrial& a, const TuneTrial& b, TuneObjective objective, double minRatio) {
+  switch(objective) {
+  case TuneObjective::THROUGHPUT:
+    return a.throughput > b.throughput;
+  case TuneObjective::SIZE:
+    return a.ratio != b.ratio ? a.ratio > b.ratio : a.throughput > b.throughput;
+  case TuneObjective::THROUGHPUT_AT_RATIO: {
+    bool aReaches = a.ratio >= minRatio;
+    bool bReaches = b.ratio >= minRatio;
+    if(aReaches != bReaches) { return aReaches; }
+    return aReaches ? a.throughput > b.throughput : a.ratio > b.ratio;
+  }
+  }
+  throw std::logic_error("Failed to switch by objective.");
+}
+
+// Searches block size and node format with the whole pool, then the compression level for
+//   the best of those, then the thread count, since the ratio does not depend on it.
+//   onTrial, when given, is told of every trial as it is measured. Returns the best trial.
+TuneTrial autotune(std::span<const std::span<const std::byte>> samples, TuneObjective objective, double minRatio = 0, const std::function<void(const TuneTrial&)>& onTrial = {}) {
+  const uint64_t blockSizes[] = { 0, 1 << 16, 1 << 18, 1 << 20, 1 << 22 };
+  const NodeFormat formats[] = { NodeFormat::INEFFICIENT, NodeFormat::P8L8, NodeFormat::P8L16, NodeFormat::P16L8, NodeFormat::P16L16 };
+
+  std::optional<TuneTrial> best;
+  auto consider = [&](const DeflateOptions& options) {
+    auto trial = measureTrial(samples, options);
+    if(onTrial) { onTrial(trial); }
+    if(!best || betterTrial(trial, *best, objective, minRatio)) {
+      best = trial;
+    }
+  };
+
+  for(auto blockSize : blockSizes) {
+    for(auto format : formats) {
+      DeflateOptions options;
+      options.blockSize = blockSize;
+      options.format = format;
+      consider(options);
+    }
+  }
+
+  for(auto level : { CompressionLevel::FASTEST, CompressionLevel::STRONG, CompressionLevel::MAX }) {
+    DeflateOptions options = best->options;
+    options.level = level;
+    consider(options);
+  }
+
+  size_t maxThreads = WorkerPool::shared().size() + 1; // the pool and the calling thread
+  for(size_t threads = 1; threads < maxThreads; threads *= 2) {
+    DeflateOptions options = best->options;
+    options.threads = threads;
+    consider(options);
+  }
+  return *best;
+}
+
+// Reads up to sampleBytes of the files into memory for autotune(), in equal shares from the
+//   middle of files spread evenly through the list.
+std::vector<std::vector<std::byte>> sampleCorpus(const std::vector<std::string>& filenames, uint64_t sampleBytes) {
+  constexpr uint64_t MIN_SHARE = 1 << 16;
+
+  std::vector<std::vector<std::byte>> samples;
+  if(filenames.empty()) { return samples; }
+
+  size_t count = (size_t)std::clamp<uint64_t>(sampleBytes / MIN_SHARE, 1, filenames.size());
+  uint64_t share = sampleBytes / count;
+  for(size_t i = 0; i < count; i++) {
+    MappedFile map(filenames[i * filenames.size() / count], MappedFile::CreationDisposition::OPEN);
+    if(map.size() == 0) { continue; }
+    uint64_t length = std::min(share, map.size());
+    auto view = map.getView((map.size() - length) / 2, (size_t)length);
+    samples.emplace_back(view.begin(), view.end());
+  }
+  return samples;
+}
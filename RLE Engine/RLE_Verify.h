@@ -0,0 +1,124 @@
+#pragma once
+#include "RLE_Inflate.h"
+#include <bit>
+#include <optional>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#define RLE_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+// Returns the index of the first byte at which a and b differ, or a.size() if they match.
+// b must be at least as long as a.
+size_t findMismatch(std::span<const std::byte> a, const std::byte* b) {
+  size_t i = 0;
+#if defined(RLE_SIMD_SSE2)
+  for(; i + sizeof(__m128i) <= a.size(); i += sizeof(__m128i)) {
+    __m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data() + i));
+    __m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs));
+    if(equal != 0xFFFF) {
+      return i + std::countr_one(equal);
+    }
+  }
+#endif
+  for(; i < a.size(); i++) {
+    if(a[i] != b[i]) { return i; }
+  }
+  return i;
+}
+
+// Returns the index of the first byte of data which is not value, or data.size() if none.
+size_t findMismatch(std::span<const std::byte> data, std::byte value) {
+  size_t i = 0;
+#if defined(RLE_SIMD_SSE2)
+  __m128i splat = _mm_set1_epi8((char)value);
+  for(; i + sizeof(__m128i) <= data.size(); i += sizeof(__m128i)) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data.data() + i));
+    uint32_t equal = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, splat));
+    if(equal != 0xFFFF) {
+      return i + std::countr_one(equal);
+    }
+  }
+#endif
+  for(; i < data.size(); i++) {
+    if(data[i] != value) { return i; }
+  }
+  return i;
+}
+
+// Compares the content an RLE image inflates to against original, without inflating it.
+// Each frame is cut into blocks of blockSize decompressed bytes which are checked in
+//   parallel straight from the literal section and run table. A frame with an entropy coded
+//   section is checked as one block, which decodes the section while it runs, so only the
+//   frames in flight hold decoded literals.
+// Returns the offset of the first differing byte, or nullopt if the two are identical. A
+//   length difference is reported at the end of the shorter of the two.
+std::optional<uint64_t> verifyDeflated(std::span<const std::byte> rleData, std::span<const std::byte> original, uint64_t blockSize = 1 << 22) {
+  struct Block {
+    size_t frame;
+    uint64_t begin; // offsets within the frame
+    uint64_t end;
+    uint64_t offset; // offset of begin within the decompressed content
+  };
+
+  auto frames = readFrames(rleData);
+  std::vector<FrameIndex> indices;
+  indices.reserve(frames.size());
+  std::vector<Block> blocks;
+  uint64_t decompressedLength = 0;
+  for(size_t i = 0; i < frames.size(); i++) {
+    indices.emplace_back(frames[i]);
+    uint64_t frameBlockSize = frames[i].codedLiterals.empty() ? blockSize : frames[i].decompressedLength();
+    for(uint64_t begin = 0; begin < frames[i].decompressedLength(); begin += frameBlockSize) {
+      uint64_t end = std::min(begin + frameBlockSize, frames[i].decompressedLength());
+      blocks.push_back({ i, begin, end, decompressedLength + begin });
+    }
+    decompressedLength += frames[i].decompressedLength();
+  }
+
+  // Blocks lying past a mismatch which has already been found are skipped.
+  uint64_t comparable = std::min<uint64_t>(decompressedLength, original.size());
+  std::atomic<uint64_t> firstMismatch = comparable;
+  parallelFor(blocks.size(), [&](size_t b) {
+    auto& block = blocks[b];
+    uint64_t pos = block.offset;
+    uint64_t stop = std::min(block.offset + (block.end - block.begin), comparable);
+    if(pos >= stop || pos >= firstMismatch) { return; }
+
+    bool differs = false;
+    auto check = [&](size_t length, size_t matched) {
+      pos += matched;
+      differs = matched != length;
+    };
+    auto onLiterals = [&](std::span<const std::byte> literals) {
+      if(differs || pos >= stop) { return; }
+      literals = literals.first((size_t)std::min<uint64_t>(literals.size(), stop - pos));
+      check(literals.size(), findMismatch(literals, original.data() + pos));
+    };
+    auto onRun = [&](std::byte value, uint64_t length) {
+      if(differs || pos >= stop) { return; }
+      auto span = original.subspan((size_t)pos, (size_t)std::min(length, stop - pos));
+      check(span.size(), findMismatch(span, value));
+    };
+    walkFrame(frames[block.frame], indices[block.frame], block.begin, block.end, onLiterals, onRun);
+
+    if(differs) {
+      uint64_t current = firstMismatch;
+      while(pos < current && !firstMismatch.compare_exchange_weak(current, pos)) {}
+    }
+  });
+
+  if(firstMismatch < comparable || decompressedLength != original.size()) {
+    return firstMismatch.load();
+  }
+  return std::nullopt;
+}
+
+std::optional<uint64_t> verifyFile(const std::string& rleFilename, const std::string& originalFilename) {
+  MappedFile rleMap(rleFilename, MappedFile::CreationDisposition::OPEN);
+  MappedFile originalMap(originalFilename, MappedFile::CreationDisposition::OPEN);
+  auto rleView = rleMap.getView(0, rleMap.size());
+  auto originalView = originalMap.getView(0, originalMap.size());
+  return verifyDeflated(rleView, originalView);
+}
@@ -1,7 +1,23 @@
 #include "RLE_Inflate.h"
 #include "RLE_Deflate.h"
+#include "RLE_Checksum.h"
+#include "RLE_Verify.h"
+#include "RLE_Edit.h"
+#include "RLE_Archive.h"
+#include "RLE_Async.h"
+#include "RLE_Service.h"
+#include "RLE_Lazy.h"
+#include "RLE_FormatCache.h"
+#include "RLE_Tune.h"
+#include "PipeServer.h"
+#include "LazyRegion.h"
+#include <atomic>
+#include <chrono>
+#include <excpt.h>
 #include <filesystem>
 #include <iostream>
+#include <sstream>
+#include <thread>
 
 template <class NodeType>
 int64_t measureEfficiency(const std::vector<NodeType>& nodes) {
@@ -25,6 +41,114 @@ int64_t measureEfficiency(const std::vector<NodeType>& nodes) {
   return efficiency;
 }
 
+// Writes to address, returning whether the write raised an access violation. __try cannot
+//   share a function with objects which need unwinding, so this is kept apart.
+bool writeFaults(const std::byte* address) {
+  constexpr unsigned long ACCESS_VIOLATION = 0xC0000005; // EXCEPTION_ACCESS_VIOLATION
+  __try {
+    *const_cast<volatile std::byte*>(address) = std::byte{ 1 };
+  }
+  __except(GetExceptionCode() == ACCESS_VIOLATION ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH) {
+    return true;
+  }
+  return false;
+}
+
+// Drives LazyRegion through real faults: concurrent first reads of the same blocks, and writes
+//   to blocks both before and after they are filled, which must fault rather than be retried.
+void lazyRegionTest() {
+  constexpr uint64_t BLOCK_SIZE = 1 << 16;
+  constexpr uint64_t LENGTH = BLOCK_SIZE * 64 + 123;
+  auto expect = [](uint64_t offset) { return (std::byte)((offset * 31) >> 3); };
+  std::atomic<uint64_t> fills = 0;
+  LazyRegion region(LENGTH, BLOCK_SIZE, [&](uint64_t offset, std::span<std::byte> block) {
+    for(size_t i = 0; i < block.size(); i++) {
+      block[i] = expect(offset + i);
+    }
+    fills++;
+  });
+  auto data = region.data();
+
+  bool unfilledWrite = writeFaults(data.data() + BLOCK_SIZE * 5) && fills == 0;
+  std::cout << "Testing Lazy Region Write Before Fill: " << (unfilledWrite ? "Pass" : "Fail") << "\n";
+
+  // Every reader touches every block, so most first reads find another thread filling it.
+  std::atomic<bool> readsMatch = true;
+  std::vector<std::thread> readers;
+  for(uint64_t t = 0; t < 8; t++) {
+    readers.emplace_back([&, t] {
+      for(uint64_t offset = t * 997 % BLOCK_SIZE; offset < LENGTH; offset += BLOCK_SIZE / 2) {
+        if(data[(size_t)offset] != expect(offset)) { readsMatch = false; }
+      }
+    });
+  }
+  for(auto& reader : readers) { reader.join(); }
+  readsMatch = readsMatch && data[(size_t)LENGTH - 1] == expect(LENGTH - 1);
+  std::cout << "Testing Lazy Region Reads: " << (readsMatch && fills == (LENGTH + BLOCK_SIZE - 1) / BLOCK_SIZE ? "Pass" : "Fail") << "\n";
+
+  bool filledWrite = writeFaults(data.data() + BLOCK_SIZE * 5) && data[(size_t)BLOCK_SIZE * 5] == expect(BLOCK_SIZE * 5);
+  std::cout << "Testing Lazy Region Write After Fill: " << (filledWrite ? "Pass" : "Fail") << "\n";
+}
+
+// Runs the batch paths over the test file with an empty file on either side of it, which is
+//   opened without a mapping and so must never be viewed.
+void emptyFileTest(const std::string& testfile) {
+  std::string empty = testfile + ".empty";
+  std::vector<BatchJob> jobs = { { empty, empty + ".rle" }, { testfile, testfile + ".batch.rle" }, { empty, empty + ".budget.rle" } };
+  for(auto& job : jobs) {
+    std::filesystem::remove(job.outputFilename);
+  }
+  std::filesystem::remove(empty);
+  { MappedFile create(empty, MappedFile::CreationDisposition::CREATE); }
+
+  DeflateOptions budget;
+  budget.maxMemory = 64 << 20;
+  deflateBatch({ jobs[0], jobs[1] });
+  deflateBatch({ jobs[2] }, budget);
+  bool emptyOutputs = std::filesystem::file_size(jobs[0].outputFilename) == 0 && std::filesystem::file_size(jobs[2].outputFilename) == 0;
+  std::cout << "Testing Empty Batch Input: " << (emptyOutputs && !verifyFile(jobs[1].outputFilename, testfile) ? "Pass" : "Fail") << "\n";
+
+  // The empty .rle is then carried through everything that reads one.
+  std::vector<BatchJob> back = { { jobs[0].outputFilename, empty + ".reinflated" }, { jobs[1].outputFilename, testfile + ".batch.reinflated" } };
+  std::string concatenated = empty + ".concat.rle";
+  for(auto& job : back) {
+    std::filesystem::remove(job.outputFilename);
+  }
+  std::filesystem::remove(concatenated);
+  inflateBatch(back);
+  concatFiles({ jobs[0].outputFilename, jobs[2].outputFilename }, concatenated);
+  bool roundTrip = std::filesystem::file_size(back[0].outputFilename) == 0 && !verifyFile(jobs[0].outputFilename, empty) &&
+                   checksumDeflatedFile(jobs[0].outputFilename) == crc32c({}) && std::filesystem::file_size(concatenated) == 0;
+  std::cout << "Testing Empty Round Trip: " << (roundTrip ? "Pass" : "Fail") << "\n";
+}
+
+// Deflates the test file at STRONG in each of the ways which must give the same bytes: on the
+//   whole pool, on one thread, and gathered from segments of growing length.
+void identityTest(const std::string& testfile) {
+  MappedFile testMap(testfile, MappedFile::CreationDisposition::OPEN);
+  auto testView = testMap.getView(0, testMap.size());
+  std::span<const std::byte> data = testView;
+
+  DeflateOptions options;
+  options.level = CompressionLevel::STRONG;
+  auto deflateData = [&] {
+    auto plan = planDeflate(data, options);
+    std::vector<std::byte> deflated((size_t)plan.size());
+    plan.write(deflated);
+    return deflated;
+  };
+  auto pooled = deflateData();
+  options.threads = 1;
+  auto single = deflateData();
+
+  std::vector<std::span<const std::byte>> segments;
+  for(size_t offset = 0, length = 1; offset < data.size(); offset += length, length = length * 3 + 1) {
+    segments.push_back(data.subspan(offset, std::min(length, data.size() - offset)));
+  }
+  auto gathered = deflateGather(segments, options);
+  std::cout << "Testing Strong Identity: " << (pooled == single && pooled == gathered ? "Pass" : "Fail") << "\n";
+}
+
 void primaryTest(const std::string& testfile) {
   std::string deflated = testfile + ".rle";
   std::string inflated = testfile + ".reinflated";
@@ -39,6 +163,7 @@ void primaryTest(const std::string& testfile) {
   inflateFile(deflated, inflated);
 
   std::cout << "\nDone.\n";
+  std::cout << "Testing Verify: " << (verifyFile(deflated, testfile) ? "Fail" : "Pass") << "\n";
   MappedFile testMap(testfile, MappedFile::CreationDisposition::OPEN);
   MappedFile reinfMap(inflated, MappedFile::CreationDisposition::OPEN);
   auto deflatedSize = std::filesystem::file_size(std::filesystem::path(deflated));
@@ -47,14 +172,26 @@ void primaryTest(const std::string& testfile) {
   auto infData = testMap.getView(0, testMap.size());
   auto defData = reinfMap.getView(0, reinfMap.size());
   std::cout << "Testing Equality: " << (std::equal(infData.begin(), infData.end(), defData.begin(), defData.end()) ? "Pass" : "Fail") << "\n";
+  std::cout << "Testing Checksum: " << (checksumDeflatedFile(deflated) == crc32c(infData) ? "Pass" : "Fail") << "\n";
+  LazyInflatedMapping lazy(deflated);
+  std::cout << "Testing Lazy Mapping: " << (std::equal(infData.begin(), infData.end(), lazy.data().begin(), lazy.data().end()) ? "Pass" : "Fail") << "\n";
+  MappedFile scratchMap("", MappedFile::CreationDisposition::ANONYMOUS, testMap.size());
+  auto scratch = scratchMap.getView(0, scratchMap.size());
+  MappedFile defMap(deflated, MappedFile::CreationDisposition::OPEN);
+  inflateFrames(readFrames(defMap.getView(0, defMap.size())), scratch);
+  std::cout << "Testing Anonymous Mapping: " << (std::equal(infData.begin(), infData.end(), scratch.begin(), scratch.end()) ? "Pass" : "Fail") << "\n";
+  std::vector<std::byte> roundTrip(infData.begin(), infData.end());
+  deflateInPlace(roundTrip);
+  inflateInPlace(roundTrip);
+  std::cout << "Testing In Place: " << (std::equal(infData.begin(), infData.end(), roundTrip.begin(), roundTrip.end()) ? "Pass" : "Fail") << "\n";
+  lazyRegionTest();
+  emptyFileTest(testfile);
+  identityTest(testfile);
   std::cout << std::endl;
-
-  system("pause");
-
 }
 
 void efficiencyCalcTest(const std::string& testfile) {
-  std::vector<Run> runs;
+  ArenaVector<Run> runs;
   {
     MappedFile inMap(testfile, MappedFile::CreationDisposition::OPEN);
     auto inView = inMap.getView(0, inMap.size());
@@ -90,12 +227,46 @@ void efficiencyCalcTest(const std::string& testfile) {
 }
 
 void deflate(int argc, char** argv) {
-  if(argc != 2) { throw std::runtime_error("Usage: deflate [name of file to create deflated copy of]"); }
+  const std::string usage = "Usage: deflate [optional -p profile] [optional -l fastest, default, strong or max] [optional -m memory limit in MiB] [optional -c format cache file] [name of file to create deflated copy of]";
+  if(argc < 2) { throw std::runtime_error(usage); }
+
+  DeflateOptions options;
+  std::optional<CompressionLevel> level;
+  uint64_t maxMemory = 0;
+  std::string cacheFileName;
+  for(int i = 1; i < argc - 1; i++) {
+    std::string arg(argv[i]);
+    if(i + 1 == argc - 1) { throw std::runtime_error(usage); }
+    if(arg == "-p") {
+      options = loadProfile(argv[++i]);
+    }
+    else if(arg == "-l") {
+      level = parseLevelName(argv[++i]);
+    }
+    else if(arg == "-m") {
+      maxMemory = std::stoull(argv[++i]) << 20;
+    }
+    else if(arg == "-c") {
+      cacheFileName = argv[++i];
+    }
+    else {
+      throw std::runtime_error(usage);
+    }
+  }
+  options.maxMemory = maxMemory;
+  options.level = level.value_or(options.level);
 
-  std::string sourceFileName(argv[1]);
+  std::string sourceFileName(argv[argc - 1]);
   std::string deflatedFileName = sourceFileName + ".rle";
   std::cout << "RLE deflating file. Please wait...";
-  deflateFile(sourceFileName, deflatedFileName);
+  if(!cacheFileName.empty()) {
+    FormatCache cache(cacheFileName);
+    deflateFileCached(sourceFileName, deflatedFileName, cache, options);
+    cache.save();
+  }
+  else {
+    deflateFile(sourceFileName, deflatedFileName, options);
+  }
   std::cout << "\nFinished.\n\n";
   auto originalSize = std::filesystem::file_size(std::filesystem::path(sourceFileName));
   auto deflatedSize = std::filesystem::file_size(std::filesystem::path(deflatedFileName));
@@ -114,30 +285,268 @@ void inflate(int argc, char** argv) {
   std::cout << "\nFinished.\n\n";
 }
 
-int main(/*int argc, char** argv*/) {
-  primaryTest("testfile.txt");
-  return 0;
+void verify(int argc, char** argv) {
+  if(argc != 3) { throw std::runtime_error("Usage: verify [name of RLE file] [name of original file]"); }
 
-//#define BUILD_DEFLATE
-  /*
-  try {
-#if defined BUILD_DEFLATE
-    deflate(argc, argv);
-#else
-    inflate(argc, argv);
-#endif
+  std::string rleFileName(argv[1]);
+  std::string originalFileName(argv[2]);
+  std::cout << "Verifying RLE file. Please wait...";
+  auto mismatch = verifyFile(rleFileName, originalFileName);
+  std::cout << "\nFinished.\n\n";
+  if(mismatch) {
+    std::cout << "Mismatch at offset " << *mismatch << "\n";
   }
-  catch(const std::exception& e) {
-    std::cout << e.what() << "\n\n";
-    system("pause");
+  else {
+    std::cout << "Files match.\n";
   }
-  */
 }
 
+void slice(int argc, char** argv) {
+  if(argc != 5) { throw std::runtime_error("Usage: slice [name of RLE file] [name of RLE file to create] [offset] [length]"); }
+
+  std::cout << "Slicing RLE file. Please wait...";
+  sliceFile(argv[1], argv[2], std::stoull(argv[3]), std::stoull(argv[4]));
+  std::cout << "\nFinished.\n\n";
+}
+
+void concat(int argc, char** argv) {
+  if(argc < 3) { throw std::runtime_error("Usage: concat [name of RLE file to create] [names of RLE files to join, in order]"); }
+
+  std::vector<std::string> inputFileNames(argv + 2, argv + argc);
+  std::cout << "Concatenating RLE files. Please wait...";
+  concatFiles(inputFileNames, argv[1]);
+  std::cout << "\nFinished.\n\n";
+}
+
+void transcode(int argc, char** argv) {
+  const std::string usage = "Usage: transcode [name of RLE file] [name of RLE file to create] [optional node format: 11, 12, 21 or 22]";
+  if(argc != 3 && argc != 4) { throw std::runtime_error(usage); }
+
+  std::optional<NodeFormat> format;
+  if(argc == 4) {
+    std::string name(argv[3]);
+    for(auto known : { NodeFormat::P8L8, NodeFormat::P8L16, NodeFormat::P16L8, NodeFormat::P16L16 }) {
+      std::ostringstream hex;
+      hex << std::hex << (int)known;
+      if(name == hex.str()) { format = known; }
+    }
+    if(!format) { throw std::runtime_error(usage); }
+  }
+  std::cout << "Transcoding RLE file. Please wait...";
+  transcodeFile(argv[1], argv[2], format);
+  std::cout << "\nFinished.\n\n";
+}
 
+void append(int argc, char** argv) {
+  if(argc != 3) { throw std::runtime_error("Usage: append [name of RLE file to extend] [name of file holding the new data]"); }
 
+  std::cout << "Appending to RLE file. Please wait...";
+  appendFile(argv[1], std::string(argv[2]));
+  std::cout << "\nFinished.\n\n";
+}
 
+void update(int argc, char** argv) {
+  if(argc < 4 || argc % 2 != 0) { throw std::runtime_error("Usage: update [name of RLE file] [name of modified file] [name of RLE file to create] [offset length]..."); }
 
+  std::vector<ByteRange> dirtyRanges;
+  for(int i = 4; i < argc; i += 2) {
+    dirtyRanges.push_back({ std::stoull(argv[i]), std::stoull(argv[i + 1]) });
+  }
+  std::cout << "Updating RLE file. Please wait...";
+  updateFile(argv[1], argv[2], dirtyRanges, argv[3]);
+  std::cout << "\nFinished.\n\n";
+}
 
+void archive(int argc, char** argv) {
+  if(argc < 3) { throw std::runtime_error("Usage: archive [name of archive to create] [names of files to add]"); }
 
+  std::vector<std::string> memberFileNames(argv + 2, argv + argc);
+  std::cout << "Creating RLE archive. Please wait...";
+  createArchive(argv[1], memberFileNames);
+  std::cout << "\nFinished.\n\n";
+}
 
+void extract(int argc, char** argv) {
+  if(argc != 4) { throw std::runtime_error("Usage: extract [name of archive] [name of member] [name of file to create]"); }
+
+  std::cout << "Extracting archive member. Please wait...";
+  ArchiveReader(argv[1]).extract(argv[2], argv[3]);
+  std::cout << "\nFinished.\n\n";
+}
+
+// Collects the files named on the command line, descending into directories. Within a
+//   directory, only files whose names do or do not end in ".rle" are taken, as wanted.
+std::vector<std::string> collectFiles(const std::vector<std::string>& paths, bool rleFiles) {
+  std::vector<std::string> files;
+  for(auto& path : paths) {
+    if(!std::filesystem::is_directory(path)) {
+      files.push_back(path);
+      continue;
+    }
+    for(auto& entry : std::filesystem::recursive_directory_iterator(path)) {
+      if(entry.is_regular_file() && (entry.path().extension() == ".rle") == rleFiles) {
+        files.push_back(entry.path().string());
+      }
+    }
+  }
+  return files;
+}
+
+void batch(int argc, char** argv) {
+  const std::string usage = "Usage: batch [deflate or inflate] [optional -p profile] [optional -l fastest, default, strong or max] [optional -t thread count] [optional -m memory limit in MiB] [names of files or directories]";
+  if(argc < 3) { throw std::runtime_error(usage); }
+
+  std::string mode(argv[1]);
+  if(mode != "deflate" && mode != "inflate") { throw std::runtime_error(usage); }
+
+  DeflateOptions options;
+  std::optional<CompressionLevel> level;
+  uint64_t maxMemory = 0;
+  std::vector<std::string> paths;
+  for(int i = 2; i < argc; i++) {
+    std::string arg(argv[i]);
+    if(arg == "-p" && i + 1 < argc) {
+      options = loadProfile(argv[++i]);
+    }
+    else if(arg == "-l" && i + 1 < argc) {
+      level = parseLevelName(argv[++i]);
+    }
+    else if((arg == "-t" || arg == "-m") && i + 1 < argc) {
+      auto value = std::stoull(argv[++i]);
+      if(arg == "-t") {
+        WorkerPool::configureShared((size_t)value);
+      }
+      else {
+        maxMemory = value << 20;
+      }
+    }
+    else {
+      paths.push_back(arg);
+    }
+  }
+  options.maxMemory = maxMemory;
+  options.level = level.value_or(options.level);
+
+  std::vector<BatchJob> jobs;
+  uint64_t inputSize = 0;
+  for(auto& file : collectFiles(paths, mode == "inflate")) {
+    std::string output = file;
+    if(mode == "deflate") {
+      output += ".rle";
+    }
+    else if(output.size() > 4 && output.ends_with(".rle")) {
+      output.resize(output.size() - (sizeof(".rle") - 1));
+    }
+    else {
+      throw std::runtime_error("Not an RLE file: " + file);
+    }
+    inputSize += std::filesystem::file_size(file);
+    jobs.push_back({ file, output });
+  }
+
+  std::cout << "Processing " << jobs.size() << " files. Please wait...";
+  auto start = std::chrono::steady_clock::now();
+  if(mode == "deflate") {
+    deflateBatch(jobs, options);
+  }
+  else {
+    inflateBatch(jobs);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  std::cout << "\nFinished.\n\n";
+
+  uint64_t outputSize = 0;
+  for(auto& job : jobs) {
+    outputSize += std::filesystem::file_size(job.outputFilename);
+  }
+  std::cout << "Input: " << inputSize << " bytes, output: " << outputSize << " bytes\n";
+  auto uncompressedSize = mode == "deflate" ? inputSize : outputSize;
+  std::cout << "Elapsed: " << elapsed.count() << " s, throughput: " << (double)uncompressedSize / (1 << 20) / elapsed.count() << " MiB/s uncompressed\n";
+}
+
+void autotune(int argc, char** argv) {
+  const std::string usage = "Usage: autotune [throughput, size, or the least ratio of input to output to reach] [optional -s sample size in MiB] [profile to create] [names of files or directories]";
+  if(argc < 4) { throw std::runtime_error(usage); }
+
+  std::string goal(argv[1]);
+  TuneObjective objective = TuneObjective::THROUGHPUT_AT_RATIO;
+  double minRatio = 0;
+  if(goal == "throughput") {
+    objective = TuneObjective::THROUGHPUT;
+  }
+  else if(goal == "size") {
+    objective = TuneObjective::SIZE;
+  }
+  else {
+    minRatio = std::stod(goal);
+  }
+
+  int next = 2;
+  uint64_t sampleBytes = 64ull << 20;
+  if(std::string(argv[next]) == "-s") {
+    if(argc < 6) { throw std::runtime_error(usage); }
+    sampleBytes = std::stoull(argv[next + 1]) << 20;
+    next += 2;
+  }
+  std::string profileFileName(argv[next++]);
+
+  auto samples = sampleCorpus(collectFiles(std::vector<std::string>(argv + next, argv + argc), false), sampleBytes);
+  std::vector<std::span<const std::byte>> sampleSpans(samples.begin(), samples.end());
+  if(sampleSpans.empty()) { throw std::runtime_error("Nothing to sample."); }
+
+  std::cout << "Tuning on " << segmentsLength(std::span<const std::span<const std::byte>>(sampleSpans)) << " sampled bytes.\n";
+  auto best = autotune(sampleSpans, objective, minRatio, [](const TuneTrial& trial) {
+    std::cout << "blockSize=" << trial.options.blockSize << " format=" << formatName(trial.options.format) << " level=" << levelName(trial.options.level) << " threads=" << trial.options.threads
+              << ": " << trial.throughput << " MiB/s, ratio " << trial.ratio << "\n";
+  });
+
+  std::ostringstream measured;
+  measured << "measured " << best.throughput << " MiB/s at ratio " << best.ratio;
+  saveProfile(profileFileName, best.options, measured.str());
+  std::cout << "\nBest: blockSize=" << best.options.blockSize << " format=" << formatName(best.options.format) << " level=" << levelName(best.options.level) << " threads=" << best.options.threads
+            << " (" << measured.str() << ")\nProfile written to " << profileFileName << "\n";
+}
+
+void serve(int argc, char** argv) {
+  if(argc != 2 && argc != 3) { throw std::runtime_error("Usage: serve [name of pipe to listen on] [optional number of requests to run at once]"); }
+
+  // Connections hold the service through their copies of the handler, since they may outlive this call.
+  auto service = std::make_shared<CompressionService>(argc == 3 ? std::stoul(argv[2]) : 2);
+  std::cout << "Serving RLE requests on \\\\.\\pipe\\" << argv[1] << "\n";
+  serveNamedPipe(argv[1], [service](const std::string& request) { return service->handle(request); });
+}
+
+void test(int argc, char** argv) {
+  if(argc != 2) { throw std::runtime_error("Usage: test [name of file to run the self tests on]"); }
+
+  efficiencyCalcTest(argv[1]);
+  primaryTest(argv[1]);
+}
+
+int main(int argc, char** argv) {
+  const std::pair<const char*, void(*)(int, char**)> COMMANDS[] = {
+    { "deflate", deflate }, { "inflate", inflate }, { "verify", verify }, { "slice", slice },
+    { "concat", concat }, { "transcode", transcode }, { "append", append }, { "update", update },
+    { "archive", archive }, { "extract", extract }, { "batch", batch }, { "serve", serve },
+    { "autotune", autotune }, { "test", test },
+  };
+
+  try {
+    std::string usage = "Usage: [command] [arguments of the command], where command is one of:";
+    for(auto& command : COMMANDS) {
+      usage += std::string(" ") + command.first;
+    }
+    if(argc < 2) { throw std::runtime_error(usage); }
+
+    // Each command sees its own name as argv[0], as it would if it were built on its own.
+    std::string name(argv[1]);
+    auto found = std::find_if(std::begin(COMMANDS), std::end(COMMANDS), [&](auto& entry) { return name == entry.first; });
+    if(found == std::end(COMMANDS)) { throw std::runtime_error(usage); }
+    found->second(argc - 1, argv + 1);
+  }
+  catch(const std::exception& e) {
+    std::cout << e.what() << "\n\n";
+    return 1;
+  }
+  return 0;
+}